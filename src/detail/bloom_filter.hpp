@@ -0,0 +1,45 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+
+namespace mmdns::detail {
+
+// A fixed size Bloom filter over 64 bit hashes the caller already has. Every
+// key sets three bits, picked from the two halves of its hash (Kirsch and
+// Mitzenmacher), so there is no hashing here.
+template <size_t bit_count>
+class bloom_filter {
+ public:
+  void insert(uint64_t hash) {
+    for (size_t probe = 0; probe < probe_count; probe++) {
+      bits_.set(index_(hash, probe));
+    }
+  }
+
+  // False means the key was never inserted, true that it probably was
+  bool may_contain(uint64_t hash) const {
+    for (size_t probe = 0; probe < probe_count; probe++) {
+      if (!bits_.test(index_(hash, probe))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void clear() { bits_.reset(); }
+
+ private:
+  static constexpr size_t probe_count = 3;
+
+  static size_t index_(uint64_t hash, size_t probe) {
+    const uint32_t low = static_cast<uint32_t>(hash);
+    const uint32_t high = static_cast<uint32_t>(hash >> 32) | 1;
+    return (low + probe * high) % bit_count;
+  }
+
+  std::bitset<bit_count> bits_;
+};
+
+}  // namespace mmdns::detail
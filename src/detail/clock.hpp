@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio/basic_waitable_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+namespace mmdns::detail {
+
+// The clock everything that schedules or timestamps goes by. It is the steady
+// clock, unless a simulation takes it over: then time stands still until the
+// simulation moves it on, and timers fire in virtual time whatever the wall
+// clock does. The whole process goes by the one clock, so a simulation can't
+// share it with real clients.
+struct clock {
+  using duration = std::chrono::steady_clock::duration;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::steady_clock::time_point;
+  static constexpr bool is_steady = true;
+
+  static time_point now() {
+    if (simulated_.load(std::memory_order_relaxed)) {
+      return time_point(duration(virtual_now_.load(std::memory_order_relaxed)));
+    }
+    return std::chrono::steady_clock::now();
+  }
+
+  static bool simulated() {
+    return simulated_.load(std::memory_order_relaxed);
+  }
+
+  // Hands the clock over to a simulation, starting at |start|, or back to the
+  // steady clock
+  static void simulate(time_point start) {
+    virtual_now_.store(start.time_since_epoch().count(),
+                       std::memory_order_relaxed);
+    simulated_.store(true, std::memory_order_relaxed);
+  }
+
+  static void stop_simulating() {
+    simulated_.store(false, std::memory_order_relaxed);
+  }
+
+  // Moves virtual time on, never back
+  static void advance_to(time_point when) {
+    if (when > now()) {
+      virtual_now_.store(when.time_since_epoch().count(),
+                         std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  inline static std::atomic<bool> simulated_{false};
+  inline static std::atomic<rep> virtual_now_{0};
+};
+
+// In virtual time there is nothing to wait for, a timer is due or it isn't
+struct clock_wait_traits {
+  static clock::duration to_wait_duration(const clock::duration& remaining) {
+    return clock::simulated() ? clock::duration::zero() : remaining;
+  }
+
+  static clock::duration to_wait_duration(const clock::time_point& deadline) {
+    return to_wait_duration(deadline - clock::now());
+  }
+};
+
+using timer = boost::asio::basic_waitable_timer<clock, clock_wait_traits>;
+
+namespace internal {
+inline std::atomic<bool> seeded{false};
+inline std::atomic<uint64_t> next_seed{0};
+}  // namespace internal
+
+// Seeds the random delays RFC 6762 asks for. They come from the system unless
+// seed_randomness() was called, then from a sequence that starts at its
+// seed, so that a simulation plays out the same way every run.
+inline uint32_t random_seed() {
+  if (!internal::seeded.load(std::memory_order_relaxed)) {
+    return std::random_device{}();
+  }
+
+  std::seed_seq sequence{internal::next_seed.fetch_add(1)};
+  uint32_t seed;
+  sequence.generate(&seed, &seed + 1);
+  return seed;
+}
+
+inline void seed_randomness(uint64_t seed) {
+  internal::next_seed.store(seed);
+  internal::seeded.store(true, std::memory_order_relaxed);
+}
+
+}  // namespace mmdns::detail
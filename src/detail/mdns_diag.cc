@@ -1,7 +0,0 @@
-#include "mdns_diag.hpp"
-
-#include <iostream>
-
-void diag(const std::string& msg) {
-  std::cout << msg << std::endl;
-}
\ No newline at end of file
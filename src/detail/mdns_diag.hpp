@@ -1,8 +0,0 @@
-#ifndef MDNS_DIAG_HPP
-#define MDNS_DIAG_HPP
-
-#include <string>
-
-void diag(const std::string& msg);
-
-#endif
\ No newline at end of file
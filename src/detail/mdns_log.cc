@@ -0,0 +1,227 @@
+#include "mdns_log.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+namespace mmdns::detail {
+
+// A line in the ring
+struct log_slot {
+  std::atomic<size_t> sequence;
+  log_level level;
+  uint16_t size;
+  char text[log_line::max_size];
+};
+
+namespace {
+
+log_level initial_log_level() {
+  const char* configured = std::getenv("MMDNS_LOG_LEVEL");
+  if (configured == nullptr) {
+    return log_level::info;
+  }
+
+  for (auto level : {log_level::trace, log_level::debug, log_level::info,
+                     log_level::warning, log_level::error, log_level::off}) {
+    if (std::strcmp(configured, to_string(level)) == 0) {
+      return level;
+    }
+  }
+  return log_level::info;
+}
+
+// A bounded ring of fixed size slots that any number of threads fill and one
+// drains, after Dmitry Vyukov's bounded MPMC queue. Every slot carries a
+// sequence number that says whose turn it is: a producer owns the slot at
+// |pos| when its sequence is |pos|, the consumer when it is |pos| + 1.
+class log_ring {
+ public:
+  static constexpr size_t capacity = 1024;
+
+  log_ring() : head_(0), tail_(0), drained_(0), dropped_(0) {
+    for (size_t idx = 0; idx < capacity; idx++) {
+      slots_[idx].sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  // A slot for the producer to fill at |pos|, or null when the ring is full
+  log_slot* claim(size_t& pos) {
+    pos = head_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& claimed = slots_[pos & (capacity - 1)];
+      const size_t sequence = claimed.sequence.load(std::memory_order_acquire);
+      const auto lag = static_cast<intptr_t>(sequence - pos);
+      if (lag == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          return &claimed;
+        }
+      } else if (lag < 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void publish(log_slot& filled, size_t pos) {
+    filled.sequence.store(pos + 1, std::memory_order_release);
+  }
+
+  // Calls visitor(const log_slot&) for the lines ready in order, up to the
+  // first one still being written. Only ever called from the writer thread.
+  template <typename slot_visitor>
+  size_t drain(slot_visitor&& visitor) {
+    size_t count = 0;
+    for (;;) {
+      auto& ready = slots_[tail_ & (capacity - 1)];
+      if (ready.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+        return count;
+      }
+
+      visitor(ready);
+      ready.sequence.store(tail_ + capacity, std::memory_order_release);
+      tail_++;
+      count++;
+    }
+  }
+
+  size_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  size_t published() const { return head_.load(std::memory_order_acquire); }
+
+  size_t drained() const { return drained_.load(std::memory_order_acquire); }
+
+  void set_drained() { drained_.store(tail_, std::memory_order_release); }
+
+ private:
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) size_t tail_;
+  std::atomic<size_t> drained_;
+  std::atomic<size_t> dropped_;
+  log_slot slots_[capacity];
+};
+
+// Writes the ring out to stdout from its own thread. Producers never wake it
+// up, that would cost them a syscall; it polls instead, often enough that
+// lines show up promptly and rarely enough to cost nothing when idle.
+class log_writer {
+ public:
+  log_writer() : ring_(), stopping_(false), thread_([this] { run_(); }) {}
+
+  ~log_writer() {
+    stopping_.store(true, std::memory_order_relaxed);
+    thread_.join();
+  }
+
+  log_ring& ring() { return ring_; }
+
+  void flush() {
+    const size_t target = ring_.published();
+    while (ring_.drained() < target) {
+      std::this_thread::sleep_for(poll_interval / 10);
+    }
+  }
+
+ private:
+  static constexpr auto poll_interval = std::chrono::milliseconds(20);
+
+  void run_() {
+    size_t reported_drops = 0;
+    for (;;) {
+      const bool stopping = stopping_.load(std::memory_order_relaxed);
+      const size_t written = ring_.drain([](const log_slot& line) {
+        std::fprintf(stdout, "%s: %.*s\n", to_string(line.level),
+                     static_cast<int>(line.size), line.text);
+      });
+
+      const size_t dropped = ring_.dropped();
+      if (dropped != reported_drops) {
+        std::fprintf(stdout, "%s: %zu log lines dropped\n",
+                     to_string(log_level::warning), dropped - reported_drops);
+        reported_drops = dropped;
+      }
+
+      if (written != 0) {
+        std::fflush(stdout);
+      }
+      ring_.set_drained();
+
+      if (stopping) {
+        return;
+      }
+      if (written == 0) {
+        std::this_thread::sleep_for(poll_interval);
+      }
+    }
+  }
+
+  log_ring ring_;
+  std::atomic<bool> stopping_;
+  std::thread thread_;
+};
+
+// Started on the first line and stopped, with every line written, at exit
+log_writer& writer() {
+  static log_writer instance;
+  return instance;
+}
+
+}  // namespace
+
+std::atomic<log_level> current_log_level{initial_log_level()};
+
+const char* to_string(log_level level) {
+  switch (level) {
+    case log_level::trace:
+      return "trace";
+    case log_level::debug:
+      return "debug";
+    case log_level::info:
+      return "info";
+    case log_level::warning:
+      return "warning";
+    case log_level::error:
+      return "error";
+    case log_level::off:
+      return "off";
+  }
+  return "unknown";
+}
+
+void set_log_level(log_level level) {
+  current_log_level.store(level, std::memory_order_relaxed);
+}
+
+size_t dropped_log_lines() {
+  return writer().ring().dropped();
+}
+
+void flush_log() {
+  writer().flush();
+}
+
+log_line::log_line(log_level level)
+    : slot_(nullptr), position_(0), text_(nullptr), size_(nullptr) {
+  slot_ = writer().ring().claim(position_);
+  if (slot_ == nullptr) {
+    return;
+  }
+
+  slot_->level = level;
+  slot_->size = 0;
+  text_ = slot_->text;
+  size_ = &slot_->size;
+}
+
+log_line::~log_line() {
+  if (slot_ != nullptr) {
+    writer().ring().publish(*slot_, position_);
+  }
+}
+
+}  // namespace mmdns::detail
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <streambuf>
+#include <string_view>
+#include <type_traits>
+
+// Levels below this one compile to nothing, arguments and all. 0 keeps every
+// level down to trace, see mmdns::detail::log_level for the others.
+#ifndef MMDNS_MIN_LOG_LEVEL
+#define MMDNS_MIN_LOG_LEVEL 0
+#endif
+
+namespace mmdns::detail {
+
+enum class log_level : uint8_t { trace, debug, info, warning, error, off };
+
+const char* to_string(log_level level);
+
+// Lines below |level| are dropped before their arguments are even looked at.
+// Starts at info, or at what MMDNS_LOG_LEVEL says in the environment, e.g.
+// MMDNS_LOG_LEVEL=debug.
+void set_log_level(log_level level);
+
+extern std::atomic<log_level> current_log_level;
+
+inline bool log_enabled(log_level level) {
+  return level >= current_log_level.load(std::memory_order_relaxed);
+}
+
+// Lines lost to a full ring since the start
+size_t dropped_log_lines();
+
+// Waits until every line logged so far is written out
+void flush_log();
+
+struct log_slot;
+
+// A line formatted straight into a slot of the log ring, which a background
+// thread writes out once the line is done. Nothing on the way blocks or
+// allocates: a line that finds the ring full is dropped and counted, and a
+// line longer than a slot is cut short.
+class log_line {
+ public:
+  static constexpr size_t max_size = 240;
+
+  explicit log_line(log_level level);
+
+  ~log_line();
+
+  log_line(const log_line&) = delete;
+  log_line& operator=(const log_line&) = delete;
+
+  template <typename... value_types>
+  void append(const value_types&... values) {
+    if (text_ != nullptr) {
+      (append_(values), ...);
+    }
+  }
+
+ private:
+  // Lets operator<< write into the slot, for anything that has one
+  class slot_buffer : public std::streambuf {
+   public:
+    explicit slot_buffer(log_line& line) : line_(line) {}
+
+   protected:
+    int_type overflow(int_type ch) override {
+      if (ch != traits_type::eof()) {
+        char value = traits_type::to_char_type(ch);
+        line_.append_(std::string_view(&value, 1));
+      }
+      return ch;
+    }
+
+    std::streamsize xsputn(const char* data, std::streamsize count) override {
+      line_.append_(std::string_view(data, count));
+      return count;
+    }
+
+   private:
+    log_line& line_;
+  };
+
+  void append_(std::string_view text) {
+    const size_t count = std::min(text.size(), max_size - *size_);
+    std::copy_n(text.data(), count, text_ + *size_);
+    *size_ += count;
+  }
+
+  void append_(const char* text) { append_(std::string_view(text)); }
+
+  template <typename value_type>
+  void append_(const value_type& value) {
+    if constexpr (std::is_convertible_v<const value_type&, std::string_view>) {
+      append_(std::string_view(value));
+    } else if constexpr (std::is_same_v<value_type, bool>) {
+      append_(value ? "true" : "false");
+    } else if constexpr (std::is_integral_v<value_type>) {
+      char digits[24];
+      auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+      append_(std::string_view(digits, end - digits));
+    } else {
+      slot_buffer buffer(*this);
+      std::ostream sout(&buffer);
+      sout << value;
+    }
+  }
+
+  log_slot* slot_;
+  size_t position_;
+  char* text_;
+  uint16_t* size_;
+};
+
+}  // namespace mmdns::detail
+
+// MMDNS_LOG(level, values...) writes the values, one after the other, as a
+// line at mmdns::detail::log_level::level. The values are only evaluated when
+// the level is enabled.
+#define MMDNS_LOG(level, ...)                                             \
+  do {                                                                    \
+    constexpr auto mmdns_log_level_ = ::mmdns::detail::log_level::level;  \
+    if constexpr (static_cast<int>(mmdns_log_level_) >=                   \
+                  MMDNS_MIN_LOG_LEVEL) {                                  \
+      if (::mmdns::detail::log_enabled(mmdns_log_level_)) {               \
+        ::mmdns::detail::log_line(mmdns_log_level_).append(__VA_ARGS__); \
+      }                                                                   \
+    }                                                                     \
+  } while (0)
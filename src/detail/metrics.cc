@@ -0,0 +1,127 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+
+namespace mmdns::detail {
+
+namespace {
+// Latency bucket bounds go up by powers of two from 1 µs to 2^24 µs, some 17 s
+constexpr size_t LATENCY_OCTAVES = 24;
+
+void append_format(std::string& out, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+void append_format(std::string& out, const char* format, ...) {
+  char line[256];
+  va_list args;
+  va_start(args, format);
+  const int size = std::vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (size > 0) {
+    out.append(line, std::min<size_t>(size, sizeof(line) - 1));
+  }
+}
+}  // namespace
+
+const char* to_string(counter which) {
+  switch (which) {
+    case counter::packets_received:
+      return "packets_received";
+    case counter::packets_filtered:
+      return "packets_filtered";
+    case counter::decode_errors:
+      return "decode_errors";
+    case counter::queries_matched:
+      return "queries_matched";
+    case counter::responses_sent:
+      return "responses_sent";
+    case counter::responses_suppressed:
+      return "responses_suppressed";
+    case counter::probes_sent:
+      return "probes_sent";
+    case counter::announcements_sent:
+      return "announcements_sent";
+    case counter::goodbyes_sent:
+      return "goodbyes_sent";
+    case counter::name_conflicts:
+      return "name_conflicts";
+  }
+  return "unknown";
+}
+
+const char* describe(counter which) {
+  switch (which) {
+    case counter::packets_received:
+      return "Datagrams read off the mDNS sockets";
+    case counter::packets_filtered:
+      return "Datagrams dropped before decoding, asking for no name of ours";
+    case counter::decode_errors:
+      return "Datagrams that failed to decode";
+    case counter::queries_matched:
+      return "Queries with at least one record of ours to answer with";
+    case counter::responses_sent:
+      return "Datagrams sent in answer to queries";
+    case counter::responses_suppressed:
+      return "Pending answers dropped because another responder sent them";
+    case counter::probes_sent:
+      return "Probes sent for names being registered";
+    case counter::announcements_sent:
+      return "Announcements sent for registered services";
+    case counter::goodbyes_sent:
+      return "Goodbye packets sent for withdrawn services";
+    case counter::name_conflicts:
+      return "Registrations given up because another host owns the name";
+  }
+  return "";
+}
+
+std::string metrics::to_prometheus() const {
+  const auto total = collect();
+  std::string out;
+
+  for (size_t idx = 0; idx < counter_count; idx++) {
+    const auto which = static_cast<counter>(idx);
+    append_format(out, "# HELP mmdns_%s_total %s\n", to_string(which),
+                  describe(which));
+    append_format(out, "# TYPE mmdns_%s_total counter\n", to_string(which));
+    append_format(out, "mmdns_%s_total %" PRIu64 "\n", to_string(which),
+                  total[which]);
+  }
+
+  out +=
+      "# HELP mmdns_response_latency_seconds From receiving a query to "
+      "sending its response\n"
+      "# TYPE mmdns_response_latency_seconds histogram\n";
+
+  // Every power of two starts a bucket, so each bound counts the values up
+  // to and including it by taking in the bucket it starts. Past the first
+  // octaves that bucket also holds values up to 1/8 above the bound.
+  uint64_t below = 0;
+  size_t bucket = 0;
+  for (size_t octave = 0; octave <= LATENCY_OCTAVES; octave++) {
+    const uint64_t bound = uint64_t{1} << octave;
+    for (; bucket < histogram::bucket_of(bound) + 1; bucket++) {
+      below += total.latency.count(bucket);
+    }
+    append_format(out,
+                  "mmdns_response_latency_seconds_bucket{le=\"%.6f\"} %" PRIu64
+                  "\n",
+                  bound / 1e6, below);
+  }
+
+  const uint64_t count = total.latency.total_count();
+  append_format(out,
+                "mmdns_response_latency_seconds_bucket{le=\"+Inf\"} %" PRIu64
+                "\n",
+                count);
+  append_format(out, "mmdns_response_latency_seconds_sum %.6f\n",
+                total.latency.sum() / 1e6);
+  append_format(out, "mmdns_response_latency_seconds_count %" PRIu64 "\n",
+                count);
+  return out;
+}
+
+}  // namespace mmdns::detail
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "clock.hpp"
+
+namespace mmdns::detail {
+
+enum class counter : uint8_t {
+  packets_received,
+  // Dropped on the header and question names, before decoding
+  packets_filtered,
+  decode_errors,
+  // Queries we had at least one answer for
+  queries_matched,
+  responses_sent,
+  // Pending answers another responder sent first
+  responses_suppressed,
+  probes_sent,
+  announcements_sent,
+  goodbyes_sent,
+  name_conflicts,
+};
+
+constexpr size_t counter_count =
+    static_cast<size_t>(counter::name_conflicts) + 1;
+
+// Name and help text of |which| in the Prometheus dump
+const char* to_string(counter which);
+const char* describe(counter which);
+
+// Counts of values on a log-linear scale, HdrHistogram style: values below 8
+// each get a bucket, then every power of two is split into 8 buckets, so a
+// bucket is never wider than 1/8 of the values in it. Covers up to 2^42.
+//
+// One thread records, any thread reads.
+class histogram {
+ public:
+  static constexpr size_t sub_bucket_bits = 3;
+  static constexpr size_t sub_buckets = size_t{1} << sub_bucket_bits;
+  static constexpr size_t octaves = 40;
+  static constexpr size_t bucket_count = octaves * sub_buckets;
+
+  histogram() = default;
+
+  histogram(const histogram& other) { merge(other); }
+
+  histogram& operator=(const histogram&) = delete;
+
+  static size_t bucket_of(uint64_t value) {
+    if (value < sub_buckets) {
+      return value;
+    }
+
+    const size_t shift = 63 - __builtin_clzll(value) - sub_bucket_bits;
+    const size_t bucket =
+        (shift + 1) * sub_buckets + ((value >> shift) - sub_buckets);
+    return std::min(bucket, bucket_count - 1);
+  }
+
+  // The largest value that lands in |bucket|
+  static uint64_t highest_in(size_t bucket) {
+    if (bucket < sub_buckets) {
+      return bucket;
+    }
+
+    const size_t shift = bucket / sub_buckets - 1;
+    return ((sub_buckets + bucket % sub_buckets + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    bump_(counts_[bucket_of(value)], 1);
+    bump_(sum_, value);
+  }
+
+  // Adds the counts of |other| to this one, which no one else may be writing
+  void merge(const histogram& other) {
+    for (size_t idx = 0; idx < bucket_count; idx++) {
+      bump_(counts_[idx], other.counts_[idx].load(std::memory_order_relaxed));
+    }
+    bump_(sum_, other.sum_.load(std::memory_order_relaxed));
+  }
+
+  uint64_t count(size_t bucket) const {
+    return counts_[bucket].load(std::memory_order_relaxed);
+  }
+
+  uint64_t total_count() const {
+    uint64_t total = 0;
+    for (const auto& count : counts_) {
+      total += count.load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+
+  // The value at or below which |fraction| of the recorded values are, to
+  // within the width of its bucket
+  uint64_t percentile(double fraction) const {
+    const uint64_t total = total_count();
+    if (total == 0) {
+      return 0;
+    }
+
+    const auto rank = static_cast<uint64_t>(fraction * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t idx = 0; idx < bucket_count; idx++) {
+      seen += count(idx);
+      if (seen >= rank) {
+        return highest_in(idx);
+      }
+    }
+    return highest_in(bucket_count - 1);
+  }
+
+ private:
+  // Only the owning thread writes, so there is no need for a locked add
+  static void bump_(std::atomic<uint64_t>& value, uint64_t by) {
+    value.store(value.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<uint64_t>, bucket_count> counts_{};
+  std::atomic<uint64_t> sum_{0};
+};
+
+// What the daemon has been doing: counters for every stage a packet goes
+// through, and how long it took from receiving a query to sending its
+// response, in microseconds.
+//
+// Every thread updates a copy of its own, on cache lines of its own, so
+// counting costs a plain store and threads never contend. collect() adds the
+// copies up.
+class metrics {
+ public:
+  using clock = detail::clock;
+
+  struct snapshot {
+    std::array<uint64_t, counter_count> counters{};
+    histogram latency;
+
+    uint64_t operator[](counter which) const {
+      return counters[static_cast<size_t>(which)];
+    }
+  };
+
+  metrics() : id_(next_id_()), mutex_(), shards_() {}
+
+  metrics(const metrics&) = delete;
+  metrics& operator=(const metrics&) = delete;
+
+  void add(counter which, uint64_t count = 1) {
+    auto& value = local_().counters[static_cast<size_t>(which)];
+    value.store(value.load(std::memory_order_relaxed) + count,
+                std::memory_order_relaxed);
+  }
+
+  void record_latency(clock::duration elapsed) {
+    local_().latency.record(
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+  }
+
+  snapshot collect() const {
+    snapshot total;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [thread, local] : shards_) {
+      for (size_t idx = 0; idx < counter_count; idx++) {
+        total.counters[idx] +=
+            local->counters[idx].load(std::memory_order_relaxed);
+      }
+      total.latency.merge(local->latency);
+    }
+    return total;
+  }
+
+  // Everything in the Prometheus text exposition format
+  std::string to_prometheus() const;
+
+ private:
+  struct alignas(64) shard {
+    std::array<std::atomic<uint64_t>, counter_count> counters{};
+    histogram latency;
+  };
+
+  static uint64_t next_id_() {
+    static std::atomic<uint64_t> last{0};
+    return ++last;
+  }
+
+  // The shard of the calling thread. Threads remember the shards of the last
+  // few instances they used, so the lock is only taken the first time.
+  shard& local_() {
+    struct cache_entry {
+      uint64_t id;
+      shard* local;
+    };
+    thread_local std::array<cache_entry, 16> cache{};
+
+    auto& cached = cache[id_ % cache.size()];
+    if (cached.id == id_) {
+      return *cached.local;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& local = shards_[std::this_thread::get_id()];
+    if (!local) {
+      local = std::make_unique<shard>();
+    }
+    cached = cache_entry{id_, local.get()};
+    return *local;
+  }
+
+  // Never reused, unlike addresses, so a thread's cached shard can't be
+  // mistaken for one of a later instance
+  const uint64_t id_;
+  mutable std::mutex mutex_;
+  // Shards outlive their threads, what they counted still counts
+  std::unordered_map<std::thread::id, std::unique_ptr<shard>> shards_;
+};
+
+}  // namespace mmdns::detail
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// MMDNS_NAME_KERNELS_NO_SIMD takes the uint64_t path whatever the target
+// has, which is how the tests get to it on x86-64
+#if !defined(MMDNS_NAME_KERNELS_NO_SIMD) && defined(__AVX2__)
+#define MMDNS_NAME_KERNELS_AVX2
+#elif !defined(MMDNS_NAME_KERNELS_NO_SIMD) && defined(__SSE2__)
+#define MMDNS_NAME_KERNELS_SSE2
+#endif
+
+#if defined(MMDNS_NAME_KERNELS_AVX2) || defined(MMDNS_NAME_KERNELS_SSE2)
+#include <immintrin.h>
+#endif
+
+namespace mmdns::detail {
+
+// Case folding, comparison and hashing of name labels, a block of bytes at a
+// time: 32 with AVX2, 16 with SSE2, and 8 packed in a uint64_t elsewhere.
+// Which one is picked at compile time, so -mavx2 or -march=native on x86-64
+// gets the widest. They all work on the bytes where they are, labels in a
+// packet included.
+//
+// Only ASCII letters fold, the way DNS compares names (RFC 4343 §3).
+namespace name_kernels {
+
+#if defined(MMDNS_NAME_KERNELS_AVX2)
+using block = __m256i;
+
+inline block load(const char* data) {
+  return _mm256_loadu_si256(reinterpret_cast<const block*>(data));
+}
+
+inline void store(block value, char* out) {
+  _mm256_storeu_si256(reinterpret_cast<block*>(out), value);
+}
+
+inline block mask(block value, block kept) {
+  return _mm256_and_si256(value, kept);
+}
+
+// Moves 'A'..'Z' to the bottom of the signed range, where a single compare
+// picks them out
+inline block fold(block value) {
+  const block shifted =
+      _mm256_add_epi8(value, _mm256_set1_epi8(static_cast<char>(0x80 - 'A')));
+  const block upper = _mm256_cmpgt_epi8(
+      _mm256_set1_epi8(static_cast<char>(0x80 + 26)), shifted);
+  return _mm256_or_si256(value,
+                         _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+inline bool equal(block lhs, block rhs) {
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(lhs, rhs)) == -1;
+}
+#elif defined(MMDNS_NAME_KERNELS_SSE2)
+using block = __m128i;
+
+inline block load(const char* data) {
+  return _mm_loadu_si128(reinterpret_cast<const block*>(data));
+}
+
+inline void store(block value, char* out) {
+  _mm_storeu_si128(reinterpret_cast<block*>(out), value);
+}
+
+inline block mask(block value, block kept) {
+  return _mm_and_si128(value, kept);
+}
+
+// Moves 'A'..'Z' to the bottom of the signed range, where a single compare
+// picks them out
+inline block fold(block value) {
+  const block shifted =
+      _mm_add_epi8(value, _mm_set1_epi8(static_cast<char>(0x80 - 'A')));
+  const block upper =
+      _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(0x80 + 26)), shifted);
+  return _mm_or_si128(value, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+inline bool equal(block lhs, block rhs) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs)) == 0xFFFF;
+}
+#else
+using block = uint64_t;
+
+inline block load(const char* data) {
+  block value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+inline void store(block value, char* out) {
+  memcpy(out, &value, sizeof(value));
+}
+
+inline block mask(block value, block kept) { return value & kept; }
+
+// Eight bytes at once in a register: a byte is an uppercase letter when it is
+// ASCII, at least 'A' and not above 'Z'. The high bit of each comparison is
+// moved onto the 0x20 bit.
+inline block fold(block value) {
+  constexpr block ones = 0x0101010101010101ull;
+  const block low_bits = value & (0x7F * ones);
+  const block at_least_a = low_bits + (0x80 - 'A') * ones;
+  const block above_z = low_bits + (0x7F - 'Z') * ones;
+  const block upper = ~value & (at_least_a ^ above_z) & (0x80 * ones);
+  return value | (upper >> 2);
+}
+
+inline bool equal(block lhs, block rhs) { return lhs == rhs; }
+#endif
+
+constexpr size_t BLOCK_SIZE = sizeof(block);
+constexpr size_t PAGE_SIZE = 4096;
+
+// BLOCK_SIZE bytes of ones then as many zeros: loaded from BLOCK_SIZE - n on,
+// it keeps the first n bytes of a block
+alignas(64) inline constexpr char MASKS[2 * BLOCK_SIZE] = {
+    -1, -1, -1, -1, -1, -1, -1, -1,
+#if defined(MMDNS_NAME_KERNELS_AVX2) || defined(MMDNS_NAME_KERNELS_SSE2)
+    -1, -1, -1, -1, -1, -1, -1, -1,
+#endif
+#if defined(MMDNS_NAME_KERNELS_AVX2)
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+#endif
+};
+
+// A whole block from wherever |data| is, which may run past the buffer it is
+// in. Only called when that can't cross into another page.
+#if defined(__clang__) || defined(__GNUC__)
+__attribute__((no_sanitize_address))
+#endif
+inline block load_overreading(const char* data) {
+#if defined(MMDNS_NAME_KERNELS_AVX2)
+  return _mm256_loadu_si256(reinterpret_cast<const block*>(data));
+#elif defined(MMDNS_NAME_KERNELS_SSE2)
+  return _mm_loadu_si128(reinterpret_cast<const block*>(data));
+#else
+  block value;
+  __builtin_memcpy(&value, data, sizeof(value));
+  return value;
+#endif
+}
+
+// The |size| bytes at |data|, fewer than a block, zero filled past them.
+// Reading the whole block is fine as long as it stays on the page the data
+// is on, otherwise the bytes go through a zeroed copy.
+inline block load_partial(const char* data, size_t size) {
+  if ((reinterpret_cast<uintptr_t>(data) & (PAGE_SIZE - 1)) <=
+      PAGE_SIZE - BLOCK_SIZE) {
+    return mask(load_overreading(data), load(MASKS + BLOCK_SIZE - size));
+  }
+
+  char padded[BLOCK_SIZE] = {};
+  memcpy(padded, data, size);
+  return load(padded);
+}
+
+}  // namespace name_kernels
+
+// |out| may be |data|
+inline void fold_case(const char* data, size_t size, char* out) {
+  using namespace name_kernels;
+  size_t offset = 0;
+  for (; offset + BLOCK_SIZE <= size; offset += BLOCK_SIZE) {
+    store(fold(load(data + offset)), out + offset);
+  }
+
+  if (offset < size) {
+    char folded[BLOCK_SIZE];
+    store(fold(load_partial(data + offset, size - offset)), folded);
+    memcpy(out + offset, folded, size - offset);
+  }
+}
+
+inline bool equals_ignore_case(const char* lhs, const char* rhs, size_t size) {
+  using namespace name_kernels;
+  size_t offset = 0;
+  for (; offset + BLOCK_SIZE <= size; offset += BLOCK_SIZE) {
+    if (!equal(fold(load(lhs + offset)), fold(load(rhs + offset)))) {
+      return false;
+    }
+  }
+
+  return offset == size ||
+         equal(fold(load_partial(lhs + offset, size - offset)),
+               fold(load_partial(rhs + offset, size - offset)));
+}
+
+// Chains the hash of |data|, case folded, onto |hash|. Works on zero padded
+// 8 byte words, so every block size hashes to the same value.
+inline uint64_t hash_ignore_case(uint64_t hash, const char* data, size_t size) {
+  using namespace name_kernels;
+  constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+  for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+    const size_t block_size = std::min(BLOCK_SIZE, size - offset);
+    uint64_t words[BLOCK_SIZE / sizeof(uint64_t)];
+    store(fold(block_size == BLOCK_SIZE
+                   ? load(data + offset)
+                   : load_partial(data + offset, block_size)),
+          reinterpret_cast<char*>(words));
+
+    // Only the words that hold data, the zero padding past them would make
+    // the hash depend on the block size
+    for (size_t idx = 0; idx * sizeof(uint64_t) < block_size; idx++) {
+      hash = (hash ^ words[idx]) * multiplier;
+      hash ^= hash >> 32;
+    }
+  }
+  return hash;
+}
+
+}  // namespace mmdns::detail
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace mmdns::detail {
+
+// Embedded in whatever gets scheduled on a timer_wheel, so that scheduling
+// never allocates. Destroying a node takes it off its wheel.
+struct timer_node {
+  timer_node() = default;
+  timer_node(const timer_node&) = delete;
+  timer_node& operator=(const timer_node&) = delete;
+  ~timer_node() { unlink(); }
+
+  bool is_linked() const { return next != nullptr; }
+
+  void unlink() {
+    if (is_linked()) {
+      prev->next = next;
+      next->prev = prev;
+      next = prev = nullptr;
+    }
+  }
+
+  timer_node* next = nullptr;
+  timer_node* prev = nullptr;
+  // In ticks of the wheel it is on
+  uint64_t deadline = 0;
+};
+
+// Hierarchical timing wheel (Varghese & Lauck): four levels of 64 slots, each
+// slot of a level spanning a whole turn of the level below. Scheduling and
+// cancelling are O(1); a node moves down at most three times before it
+// expires. Deadlines more than 2^24 ticks away park on the last level until
+// they come within range.
+//
+// Not thread safe, and the wheel knows nothing of clocks: the owner decides
+// what a tick is and calls advance() with the current one.
+class timer_wheel {
+ public:
+  timer_wheel() {
+    for (auto& level : slots_) {
+      for (auto& slot : level) {
+        slot.next = slot.prev = &slot;
+      }
+    }
+  }
+  timer_wheel(const timer_wheel&) = delete;
+  timer_wheel& operator=(const timer_wheel&) = delete;
+
+  ~timer_wheel() {
+    for (auto& level : slots_) {
+      for (auto& slot : level) {
+        while (slot.next != &slot) {
+          slot.next->unlink();
+        }
+        slot.next = slot.prev = nullptr;
+      }
+    }
+  }
+
+  uint64_t now() const { return now_; }
+
+  // (Re)schedules |node| to expire at |deadline|, or on the next tick when
+  // that is already past
+  void schedule(timer_node& node, uint64_t deadline) {
+    node.unlink();
+    node.deadline = std::max(deadline, now_ + 1);
+    insert_(node);
+  }
+
+  // The next tick something may happen at: a node expiring or a slot moving
+  // down a level. Only a hint, nothing may be due then after all.
+  bool next_expiry(uint64_t& tick) const {
+    bool found = false;
+    if (occupied_[0] != 0) {
+      // Slots past the current one, wrapping around
+      auto start = (now_ + 1) & slot_mask;
+      auto pending = occupied_[0] >> start;
+      if (start != 0) {
+        pending |= occupied_[0] << (slots - start);
+      }
+      tick = now_ + 1 + __builtin_ctzll(pending);
+      found = true;
+    }
+
+    for (size_t level = 1; level < levels; level++) {
+      if (occupied_[level] != 0) {
+        auto shift = level * slot_bits;
+        auto cascade = ((now_ >> shift) + 1) << shift;
+        tick = found ? std::min(tick, cascade) : cascade;
+        return true;
+      }
+    }
+
+    return found;
+  }
+
+  // Moves the wheel to |tick|, calling on_expire(timer_node&) for every node
+  // due by then. The node is unlinked first, so the handler may schedule it
+  // again or destroy it.
+  template <typename expire_handler>
+  void advance(uint64_t tick, expire_handler&& on_expire) {
+    while (now_ < tick) {
+      now_ = next_tick_(tick);
+
+      for (size_t level = levels - 1; level > 0; level--) {
+        auto shift = level * slot_bits;
+        if ((now_ & ((uint64_t{1} << shift) - 1)) == 0) {
+          cascade_(level, (now_ >> shift) & slot_mask);
+        }
+      }
+
+      auto index = now_ & slot_mask;
+      auto& slot = slots_[0][index];
+      while (slot.next != &slot) {
+        auto* node = slot.next;
+        node->unlink();
+        on_expire(*node);
+      }
+      occupied_[0] &= ~(uint64_t{1} << index);
+    }
+  }
+
+ private:
+  static constexpr size_t levels = 4;
+  static constexpr size_t slot_bits = 6;
+  static constexpr size_t slots = size_t{1} << slot_bits;
+  static constexpr uint64_t slot_mask = slots - 1;
+  static constexpr uint64_t max_span = uint64_t{1} << (levels * slot_bits);
+
+  // With the lower levels empty nothing can happen before the next slot of
+  // the first level that is not, so ticks up to it are skipped at once
+  uint64_t next_tick_(uint64_t tick) const {
+    for (size_t level = 0; level < levels; level++) {
+      if (occupied_[level] != 0) {
+        if (level == 0) {
+          return now_ + 1;
+        }
+        auto shift = level * slot_bits;
+        return std::min(tick, ((now_ >> shift) + 1) << shift);
+      }
+    }
+    return tick;
+  }
+
+  void insert_(timer_node& node) {
+    auto expires = std::min(node.deadline, now_ + max_span - 1);
+    auto delta = expires - now_;
+
+    size_t level = 0;
+    while (level + 1 < levels &&
+           delta >= (uint64_t{1} << ((level + 1) * slot_bits))) {
+      level++;
+    }
+
+    auto index = (expires >> (level * slot_bits)) & slot_mask;
+    auto& slot = slots_[level][index];
+    node.prev = slot.prev;
+    node.next = &slot;
+    slot.prev->next = &node;
+    slot.prev = &node;
+    occupied_[level] |= uint64_t{1} << index;
+  }
+
+  void cascade_(size_t level, uint64_t index) {
+    auto& slot = slots_[level][index];
+    occupied_[level] &= ~(uint64_t{1} << index);
+    while (slot.next != &slot) {
+      auto* node = slot.next;
+      node->unlink();
+      insert_(*node);
+    }
+  }
+
+  uint64_t now_ = 0;
+  // A bit per slot that may hold nodes; cancelling leaves the bit behind
+  // until the wheel gets to the slot
+  uint64_t occupied_[levels] = {};
+  timer_node slots_[levels][slots];
+};
+
+}  // namespace mmdns::detail
@@ -1,4 +1,5 @@
 #include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <thread>
 #include "mdns_client.hpp"
@@ -28,6 +29,13 @@ int main(int argc, char const* argv[]) {
   client.register_service(std::move(service1));
   client.register_service(std::move(service2));
 
+  // Where to serve the metrics from, e.g. /run/mmdnsd/metrics.sock
+  if (const char* metrics_socket = std::getenv("MMDNS_METRICS_SOCKET")) {
+    if (!client.serve_metrics(metrics_socket)) {
+      std::cerr << "Can't serve metrics on " << metrics_socket << std::endl;
+    }
+  }
+
   client.start();
   return 0;
 }
@@ -3,54 +3,157 @@
 #include <atomic>
 #include <boost/asio.hpp>
 #include <boost/thread/thread.hpp>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <optional>
 
-#include "detail/mdns_diag.hpp"
-#include "lib/dnslib/src/exception.h"
+#include "detail/clock.hpp"
+#include "detail/mdns_log.hpp"
+#include "detail/metrics.hpp"
 #include "mdns_message.hpp"
-#include "mdns_message_codec.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_prefilter.hpp"
+#include "mdns_record_cache.hpp"
+#include "mdns_service_browser.hpp"
+#include "mdns_service_resolver.hpp"
 #include "mdns_service_register.hpp"
+#include "mdns_service_responder.hpp"
+#include "mdns_service_scheduler.hpp"
+#include "net/metrics_endpoint.hpp"
+#include "net/net_batch.hpp"
+#include "net/net_transport.hpp"
 namespace mmdns::client {
 
 using namespace boost::asio;
 
-template <typename net_stream>
+// |transport| is what datagrams are read from and sent through, see
+// net::udp_transport for what it has to provide.
+template <typename net_stream, typename transport = net::udp_transport>
 class mdns_client {
  public:
-  mdns_client()
-      : in_stream_(),
+  // With |shard_count| above one, and on Linux, every shard gets its own
+  // SO_REUSEPORT socket on the mDNS port and its own io_context on a thread
+  // pinned to a core. They all answer from the same registry snapshot and
+  // feed the same scheduler.
+  explicit mdns_client(size_t shard_count = 1,
+                       const typename transport::config& config = {})
+      : datagram_pool_(),
+        metrics_(),
+        shard_count_(std::max<size_t>(1, shard_count)),
+        out_queue_(),
+        flush_pending_(false),
+        cache_(),
         io_service_(),
         worker_ctx_(),
-        socket_(io_service_),
         socket_strand_(io_service_),
-        sender_endpoint_(),
-        service_registry_(io_service_),
+        scheduler_strand_(io_service_),
+        browser_strand_(io_service_),
+        resolver_strand_(io_service_),
+        transport_(io_service_, socket_strand_, datagram_pool_, config),
+        service_registry_(io_service_, metrics_, transport_.addresses()),
+        responder_(service_registry_),
+        scheduler_(io_service_,
+                   scheduler_strand_,
+                   [this](const ip::udp::endpoint& destination,
+                          std::vector<service::scheduler::packet>&& packets,
+                          service::scheduler::clock::time_point received) {
+                     send_(destination, std::move(packets), received);
+                   }),
+        browser_(io_service_,
+                 browser_strand_,
+                 cache_,
+                 destination_endpoint,
+                 [this](const ip::udp::endpoint& destination,
+                        std::vector<packet>&& packets) {
+                   send_(destination, std::move(packets));
+                 }),
+        resolver_(io_service_,
+                  resolver_strand_,
+                  cache_,
+                  destination_endpoint,
+                  [this](const ip::udp::endpoint& destination,
+                         std::vector<packet>&& packets) {
+                    send_(destination, std::move(packets));
+                  }),
+        metrics_endpoint_(io_service_,
+                          [this]() { return metrics_.to_prometheus(); }),
+        thread_pool_(),
         signals_(io_service_, SIGINT, SIGTERM) {
-    memset(in_stream_, 0, sizeof(in_stream_));
+    service_registry_.set_send_handler(
+        [this](service::registry::packet packet) {
+          send_(destination_endpoint, {std::move(packet)});
+        });
+    service_registry_.set_goodbye_handler(
+        [this](service::registry::packet packet) {
+          transport_.send_now(destination_endpoint, packet);
+        });
   }
 
   ~mdns_client() {
+    transport_.close();
     io_service_.stop();
 
-    for (size_t idx = 0; idx < thread_pool_.size(); idx++) {
-      if (thread_pool_[idx].get()) {
-        assert(thread_pool_[idx]->joinable());
-        thread_pool_[idx]->join();
-      }
+    for (auto& thread : thread_pool_) {
+      assert(thread->joinable());
+      thread->join();
     }
 
     assert(io_service_.stopped());
   }
 
   void start() { start_(false); }
-  void async_start() { start(true); }
+  void async_start() { start_(true); }
+
+  // Starts reading from the transport and nothing else: no thread runs the
+  // client until the caller does, with poll(). That is how a simulation runs
+  // many clients on one thread.
+  void open() {
+    transport_.open(shard_count_, [this](const net::datagram_ptr& datagram) {
+      on_data(datagram);
+    });
+  }
+
+  // Runs the handlers that are ready, on the calling thread, without
+  // blocking. Returns how many ran.
+  size_t poll() {
+    size_t count = 0;
+    for (auto* ctx : {&io_service_, &worker_ctx_}) {
+      if (ctx->stopped()) {
+        ctx->restart();
+      }
+      count += ctx->poll();
+    }
+    return count;
+  }
+
+  // The goodbyes go out on the registry strand, not next to a handler
+  // changing what it publishes, and before the worker context stops. Waits
+  // for that unless called from a handler, the signal handler among them,
+  // which can't wait for the pool it runs on.
   void stop() {
-    service_registry_.stop();
-    worker_ctx_.stop();
+    auto stopped = std::make_shared<std::promise<void>>();
+    auto done = stopped->get_future();
+    service_registry_.async_stop([this, stopped]() {
+      metrics_endpoint_.stop();
+      worker_ctx_.stop();
+      stopped->set_value();
+    });
+
+    if (!thread_pool_.empty() &&
+        !io_service_.get_executor().running_in_this_thread()) {
+      done.wait();
+    }
+  }
+
+  // Dumps the metrics, in the Prometheus text format, to whoever connects to
+  // the Unix socket at |path|. Returns false when it can't be bound.
+  bool serve_metrics(const std::string& path) {
+    return metrics_endpoint_.listen(path);
   }
 
+  const detail::metrics& metrics() const { return metrics_; }
+
   void register_service(
       service::descriptor&& service,
       const std::optional<
@@ -58,85 +161,198 @@ class mdns_client {
     service_registry_.register_service(std::move(service), cb);
   }
 
-  bool unregister_service(const std::string& service_name) {}
+  void unregister_service(
+      const std::string& instance_name,
+      const std::optional<std::function<void(bool)>>& cb = {}) {
+    service_registry_.unregister_service(instance_name, cb);
+  }
 
-  void on_data(const boost::system::error_code& error, size_t bytes_recvd) {
-    if (!error) {
-      net_stream stream(in_stream_, bytes_recvd);
+  // Reports instances of |service_type|, e.g. _http._tcp.local, as they come
+  // and go. Handlers run on a strand of the client's io_service. Returns the
+  // id to stop_browse() with.
+  size_t browse(const std::string& service_type,
+                browser::instance_handler on_added,
+                browser::instance_handler on_removed) {
+    return browser_.browse(service_type, std::move(on_added),
+                           std::move(on_removed));
+  }
 
-      std::shared_ptr<dns::Message> message = std::make_shared<dns::Message>();
-      mmdns::codec::mdns_message_codec codec{*message};
+  void stop_browse(size_t id) { browser_.stop(id); }
 
-      bool decoded = false;
+  // SRV and TXT of an instance, and addresses of a host. Concurrent lookups
+  // of the same name share one query; handlers run on a strand of the
+  // client's io_service.
+  void resolve(const std::string& instance_name,
+               resolver::service_handler handler) {
+    resolver_.resolve(instance_name, std::move(handler));
+  }
+
+  std::future<std::optional<service_info>> resolve(
+      const std::string& instance_name) {
+    return resolver_.resolve(instance_name);
+  }
+
+  void resolve_host(const std::string& host_name,
+                    resolver::host_handler handler) {
+    resolver_.resolve_host(host_name, std::move(handler));
+  }
+
+  std::future<std::optional<host_info>> resolve_host(
+      const std::string& host_name) {
+    return resolver_.resolve_host(host_name);
+  }
 
-      try {
-        decoded = codec.decode(stream);
-      } catch (dns::Exception e) {
-        diag("Decoder error: " + std::string(e.what()));
+  // Records other hosts on the link have answered with, straight from memory
+  std::vector<cached_record> lookup(
+      std::string_view name,
+      message::mdns_rr_type type = message::ANY) const {
+    return cache_.lookup(name, type);
+  }
+
+  // Runs on any of the pool threads: |datagram| belongs to this call alone and
+  // only handing the outcome to the scheduler is serialized.
+  void on_data(const net::datagram_ptr& datagram) {
+    metrics_.add(detail::counter::packets_received);
+    if (!is_wanted_(*datagram)) {
+      metrics_.add(detail::counter::packets_filtered);
+      return;
+    }
+
+    net_stream stream(datagram->data, datagram->size);
+
+    message::mdns_message_t message;
+    mmdns::codec::mdns_message_decoder decoder{message};
+
+    if (auto result = decoder.decode(stream); !result) {
+      MMDNS_LOG(debug, "Decoder error: ", codec::to_string(result.error),
+                " at byte ", result.offset, " of ", datagram->size);
+      metrics_.add(detail::counter::decode_errors);
+      return;
+    }
+
+    // Answers to our probes, and other hosts' probes, may conflict with a
+    // registration still in progress
+    if (service_registry_.is_probing() &&
+        (!message.header.is_query() || !message.authorities.empty())) {
+      service_registry_.on_message(datagram, message);
+    }
+
+    if (message.header.is_query()) {
+      for (const auto& query : message.queries) {
+        MMDNS_LOG(trace, "Looking for ", query.name);
       }
 
-      // TODO: Move this code into a responder/dispatcher
-      if (decoded) {
-        io_service_.post(
-            socket_strand_.wrap([this, message = std::move(message)]() {
-              if (message->getQr() == 0 && message->getQdCount() > 0) {
-                for (const auto& query : message->getQueries()) {
-                  auto service_name = query->getName();
-                  diag("Looking for " + service_name);
-
-                  auto descriptor =
-                      service_registry_.get_service_descriptor(service_name);
-
-                  if (descriptor) {
-                    auto message = descriptor.value().get().message;
-
-                    message->setQr(1);
-                    size_t encoded_size = sizeof(out_stream_);
-                    mmdns::codec::mdns_message_codec codec{*message};
-                    bool encoded = codec.encode(out_stream_, encoded_size);
-
-                    if (encoded) {
-                      socket_.async_send_to(
-                          boost::asio::const_buffer(out_stream_, encoded_size),
-                          destination_endpoint,
-                          socket_strand_.wrap(
-                              [service_name, message](
-                                  const boost::system::error_code& ec,
-                                  std::size_t bytes_transferred) {
-                                if (!ec) {
-                                  diag("Sent response for " + service_name +
-                                       "\n" + message->asString());
-                                }
-                              }));
-                    }
-                  }
-                }
-              }
-            }));
+      auto answer = responder_.respond(message);
+      if (!answer.empty()) {
+        metrics_.add(detail::counter::queries_matched);
+        answer.received = datagram->received;
+        scheduler_strand_.post(
+            [this, destination = response_destination_(message,
+                                                       datagram->sender),
+             answer = std::move(answer)]() mutable {
+              scheduler_.schedule(destination, std::move(answer));
+            });
+      }
+    } else {
+      // Responses from any other port aren't mDNS, RFC 6762 §6
+      if (datagram->sender.port() == mdns_port) {
+        cache_.insert(message);
+        browser_.on_response(datagram, message);
+        resolver_.on_response(datagram, message);
       }
-    }
 
-    async_receive();
+      // The decoded names point into |datagram|, which goes along with them
+      scheduler_strand_.post(
+          [this, datagram, message = std::move(message)]() {
+            metrics_.add(detail::counter::responses_suppressed,
+                         scheduler_.suppress(message));
+          });
+    }
   }
 
  private:
-  void async_receive() {
-    socket_.async_receive_from(
-        boost::asio::buffer(in_stream_, sizeof(in_stream_)), sender_endpoint_,
-        socket_strand_.wrap([handler = this](boost::system::error_code ec,
-                                             std::size_t bytes_recvd) {
-          handler->on_data(ec, bytes_recvd);
-        }));
+  // Most of what arrives is queries for other hosts' names, those are dropped
+  // on their header and question names alone. Responses all go on: they feed
+  // the cache, the browser, the resolver, answer suppression and conflict
+  // detection. So do queries with records in the authority section while we
+  // probe, they may be probes for our names.
+  bool is_wanted_(const net::datagram& datagram) const {
+    codec::mdns_message_prefilter prefilter{datagram.data, datagram.size};
+    if (!prefilter.read_header()) {
+      return false;
+    }
+
+    const auto& header = prefilter.header();
+    if (!header.is_query() || (header.authority_rr_count != 0 &&
+                               service_registry_.is_probing())) {
+      return true;
+    }
+
+    return prefilter.any_question([this](message::mdns_name_hash_t hash) {
+      return service_registry_.may_own(hash);
+    });
   }
 
-  void start_(bool async) {
-    ip::udp::endpoint listen_endpoint(local_address, 5353);
-    socket_.open(listen_endpoint.protocol());
-    socket_.set_option(ip::udp::socket::reuse_address(true));
-    socket_.set_option(ip::multicast::join_group(mdns_address));
-    socket_.bind(listen_endpoint);
+  // Questions that all ask for a unicast response get one, RFC 6762 §5.4
+  ip::udp::endpoint response_destination_(
+      const message::mdns_message_t& query,
+      const ip::udp::endpoint& sender) const {
+    bool unicast = !query.queries.empty() &&
+                   std::all_of(query.queries.begin(), query.queries.end(),
+                               [](const message::mdns_query_t& question) {
+                                 return question.unicast_response;
+                               });
+    return unicast ? sender : destination_endpoint;
+  }
+
+  // Responses are queued and go out together with a single sendmmsg once the
+  // socket strand gets to them. |received| is when the query they answer came
+  // in, if they answer one.
+  void send_(const ip::udp::endpoint& destination,
+             std::vector<service::scheduler::packet>&& packets,
+             service::scheduler::clock::time_point received = {}) {
+    socket_strand_.post([this, destination, packets = std::move(packets),
+                         received]() {
+      for (const auto& packet : packets) {
+        out_queue_.push_back({destination, packet, received});
+      }
+
+      if (!flush_pending_) {
+        flush_pending_ = true;
+        socket_strand_.post([this]() { flush_(); });
+      }
+    });
+  }
+
+  void flush_() {
+    auto sent = transport_.send(out_queue_.data(), out_queue_.size());
+    const auto now = detail::clock::now();
+    for (size_t idx = 0; idx < sent; idx++) {
+      const auto received = out_queue_[idx].answers_query_from;
+      if (received != detail::clock::time_point{}) {
+        metrics_.add(detail::counter::responses_sent);
+        metrics_.record_latency(now - received);
+      }
+    }
+    out_queue_.erase(out_queue_.begin(), out_queue_.begin() + sent);
+    MMDNS_LOG(trace, "Sent ", sent, " responses");
 
-    async_receive();
+    if (out_queue_.empty()) {
+      flush_pending_ = false;
+      return;
+    }
+
+    transport_.async_wait_writable([this](bool writable) {
+      if (writable) {
+        flush_();
+      } else {
+        flush_pending_ = false;
+      }
+    });
+  }
+
+  void start_(bool async) {
+    open();
 
     worker_ctx_.post([]() {});
     signals_.async_wait(
@@ -144,16 +360,18 @@ class mdns_client {
           handler->handle_system_signal(ec, sig_num);
         });
 
-    for (size_t idx = 0; idx < thread_pool_.max_size() - 1; idx++) {
-      thread_pool_[idx] = std::make_unique<std::thread>(
-          [client = this]() { client->io_service_.run(); });
+    const size_t thread_count =
+        std::max(1u, std::thread::hardware_concurrency());
+    for (size_t idx = 0; idx < thread_count; idx++) {
+      thread_pool_.push_back(std::make_unique<std::thread>(
+          [client = this]() { client->io_service_.run(); }));
     }
 
     boost::asio::executor_work_guard<decltype(worker_ctx_.get_executor())> work{
         worker_ctx_.get_executor()};
     if (async) {
-      thread_pool_[thread_pool_.max_size() - 1] = std::make_unique<std::thread>(
-          [client = this]() { client->worker_ctx_.run(); });
+      thread_pool_.push_back(std::make_unique<std::thread>(
+          [client = this]() { client->worker_ctx_.run(); }));
     } else {
       worker_ctx_.run();
     }
@@ -166,25 +384,37 @@ class mdns_client {
   };
 
  private:
-  const ip::address local_address = ip::address::from_string("0.0.0.0");
   const ip::address mdns_address = ip::address::from_string("224.0.0.251");
   const size_t mdns_port = 5353;
   const ip::udp::endpoint destination_endpoint =
       ip::udp::endpoint(mdns_address, mdns_port);
 
-  net::net_stream_data in_stream_[1024];
-  net::net_stream_data out_stream_[1024];
+  // Declared first so that it outlives every handler and shard holding a
+  // datagram
+  net::datagram_pool datagram_pool_;
+  detail::metrics metrics_;
+  const size_t shard_count_;
+  std::vector<net::outgoing_datagram> out_queue_;
+  bool flush_pending_;
+  record_cache cache_;
 
   boost::asio::io_service io_service_;
   boost::asio::io_context worker_ctx_;
-  ip::udp::socket socket_;
+  // Socket reads and writes, and the scheduler, are the only serialized parts
   boost::asio::io_service::strand socket_strand_;
-
-  ip::udp::endpoint sender_endpoint_;
+  boost::asio::io_service::strand scheduler_strand_;
+  boost::asio::io_service::strand browser_strand_;
+  boost::asio::io_service::strand resolver_strand_;
+  transport transport_;
 
   service::registry service_registry_;
+  service::responder responder_;
+  service::scheduler scheduler_;
+  browser browser_;
+  resolver resolver_;
+  net::metrics_endpoint metrics_endpoint_;
 
-  std::array<std::unique_ptr<std::thread>, 4> thread_pool_;
+  std::vector<std::unique_ptr<std::thread>> thread_pool_;
   boost::asio::signal_set signals_;
 };
 
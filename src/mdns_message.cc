@@ -1,7 +1,152 @@
 #include "mdns_message.hpp"
 
+#include <algorithm>
+
+#include "detail/name_kernels.hpp"
+
 namespace mmdns::message {
 
+namespace {
+constexpr size_t MAX_NAME_SIZE = 255;
+
+constexpr mdns_name_hash_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+constexpr mdns_name_hash_t FNV_PRIME = 1099511628211ull;
+
+// The label size, then the lowercased label a word at a time
+mdns_name_hash_t hash_label(mdns_name_hash_t hash, std::string_view label) {
+  hash = (hash ^ label.size()) * FNV_PRIME;
+  return detail::hash_ignore_case(hash, label.data(), label.size());
+}
+
+template <typename label_visitor>
+void for_each_dotted_label(std::string_view dotted_name,
+                           label_visitor&& visitor) {
+  while (!dotted_name.empty()) {
+    auto label_end = dotted_name.find('.');
+    auto label = dotted_name.substr(0, label_end);
+    if (!label.empty()) {
+      visitor(label);
+    }
+    dotted_name.remove_prefix(label_end == std::string_view::npos
+                                  ? dotted_name.size()
+                                  : label_end + 1);
+  }
+}
+}  // namespace
+
+mdns_name_hash_t hash_dns_name(std::string_view dotted_name) {
+  mdns_name_hash_t hash = FNV_OFFSET_BASIS;
+  for_each_dotted_label(dotted_name, [&hash](std::string_view label) {
+    hash = hash_label(hash, label);
+  });
+  return hash;
+}
+
+bool dns_name_equals(std::string_view lhs, std::string_view rhs) {
+  return lhs.size() == rhs.size() &&
+         detail::equals_ignore_case(lhs.data(), rhs.data(), lhs.size());
+}
+
+std::string mdns_name_t::to_string() const {
+  std::string name;
+  for_each_label([&name](std::string_view label) {
+    if (!name.empty()) {
+      name += '.';
+    }
+    name.append(label);
+  });
+  return name;
+}
+
+mdns_name_hash_t mdns_name_t::hash() const {
+  mdns_name_hash_t hash = FNV_OFFSET_BASIS;
+  for_each_label(
+      [&hash](std::string_view label) { hash = hash_label(hash, label); });
+  return hash;
+}
+
+bool mdns_name_t::equals(std::string_view dotted_name) const {
+  bool match = true;
+  bool valid = for_each_label([&](std::string_view label) {
+    if (!match) {
+      return;
+    }
+
+    auto label_end = dotted_name.find('.');
+    auto expected = dotted_name.substr(0, label_end);
+    dotted_name.remove_prefix(label_end == std::string_view::npos
+                                  ? dotted_name.size()
+                                  : label_end + 1);
+
+    match = dns_name_equals(label, expected);
+  });
+  return valid && match && dotted_name.empty();
+}
+
+std::ostream& operator<<(std::ostream& sout, const mdns_name_t& name) {
+  return sout << name.to_string();
+}
+
+namespace {
+// The name at |offset| and the bytes it takes there, calling visitor(label)
+// for every label along the way
+template <typename label_visitor>
+std::pair<mdns_name_t, size_t> consume_name(const uint8_t* stream,
+                                            size_t stream_size,
+                                            size_t offset,
+                                            label_visitor&& visitor) {
+  mdns_name_t name{stream, static_cast<uint16_t>(stream_size),
+                   static_cast<uint16_t>(offset)};
+
+  // Bytes taken by the name at |offset|: every inline label up to either the
+  // root label or the first compression pointer
+  size_t pos = offset;
+  while (pos < stream_size) {
+    uint8_t label_size = stream[pos];
+    if ((label_size & mdns_name_t::POINTER_MASK) ==
+        mdns_name_t::POINTER_MASK) {
+      pos += 2;
+      break;
+    }
+
+    pos += 1 + label_size;
+    if (label_size == 0) {
+      break;
+    }
+  }
+
+  size_t name_size = 0;
+  bool valid = name.for_each_label([&](std::string_view label) {
+    name_size += label.size() + 1;
+    visitor(label);
+  });
+
+  if (!valid || pos > stream_size || name_size > MAX_NAME_SIZE) {
+    return std::make_pair(mdns_name_t{}, 0);
+  }
+
+  return std::make_pair(name, pos - offset);
+}
+}  // namespace
+
+std::pair<mdns_name_t, size_t> comsume_dns_name(const uint8_t* stream,
+                                                size_t stream_size,
+                                                size_t offset) {
+  return consume_name(stream, stream_size, offset, [](std::string_view) {});
+}
+
+std::pair<mdns_name_hash_t, size_t> hash_dns_name(const uint8_t* stream,
+                                                  size_t stream_size,
+                                                  size_t offset) {
+  mdns_name_hash_t hash = FNV_OFFSET_BASIS;
+  auto [name, name_size] =
+      consume_name(stream, stream_size, offset,
+                   [&hash](std::string_view label) {
+                     hash = hash_label(hash, label);
+                   });
+  return std::make_pair(hash, name_size);
+}
+
 std::string rr_type_to_string(mdns_rr_type type) {
   switch (type) {
     case A:
@@ -1,16 +1,15 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
-#include <forward_list>
 #include <iomanip>
 #include <ostream>
 #include <string>
-#include <variant>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 #include "detail/config.hpp"
 
-#include <boost/range/algorithm.hpp>
-
 namespace mmdns::message {
 
 constexpr uint16_t read_u8(const uint8_t* MMDNS_NON_NULL ptr) {
@@ -32,9 +31,95 @@ constexpr uint32_t read_u32(const uint8_t* MMDNS_NON_NULL ptr) {
     (from) += sizeof(uint##count##_t); \
   } while (0)
 
+// Hash of the lowercased wire format of a name, so that names that only differ
+// in case hash the same regardless of them being dotted strings or in a packet
+using mdns_name_hash_t = uint64_t;
+
+mdns_name_hash_t hash_dns_name(std::string_view dotted_name);
+
+// Case insensitive comparison of two dotted names
+bool dns_name_equals(std::string_view lhs, std::string_view rhs);
+
+// A non-owning view of a, possibly compressed, DNS name inside a packet. The
+// view is only valid while the packet buffer it points into is alive.
+struct mdns_name_t {
+  static constexpr auto POINTER_MASK = 0xC0;
+  // Real names never need more than a couple of pointers, crafted ones could
+  // otherwise chain thousands
+  static constexpr size_t MAX_POINTER_HOPS = 16;
+  static constexpr size_t MAX_NAME_SIZE = 255;
+
+  const uint8_t* packet = nullptr;
+  uint16_t packet_size = 0;
+  uint16_t offset = 0;
+
+  // Calls visitor(label) for every label, following compression pointers.
+  // Pointers must go strictly backwards in the packet and there can only be
+  // so many of them, which keeps a crafted packet from sending us around in
+  // circles or making us walk it over and over. Stops at the first label past
+  // the 255 bytes a name can take.
+  template <typename label_visitor>
+  bool for_each_label(label_visitor&& visitor) const {
+    size_t pos = offset;
+    size_t pointer_limit = packet_size;
+    size_t hops = 0;
+    size_t name_size = 1;
+    while (pos < packet_size) {
+      uint8_t label_size = packet[pos];
+      if ((label_size & POINTER_MASK) == POINTER_MASK) {
+        if (pos + 1 >= packet_size || ++hops > MAX_POINTER_HOPS) {
+          return false;
+        }
+        size_t target = read_u16(packet + pos) & 0x3FFF;
+        if (target >= pointer_limit || target >= pos) {
+          return false;
+        }
+        pointer_limit = pos = target;
+        continue;
+      }
+
+      if (label_size == 0) {
+        return true;
+      }
+
+      // 0x40 and 0x80 are label types nobody uses, RFC 6891 §5
+      name_size += 1 + label_size;
+      if ((label_size & POINTER_MASK) != 0 || name_size > MAX_NAME_SIZE ||
+          pos + 1 + label_size > packet_size) {
+        return false;
+      }
+
+      visitor(std::string_view(
+          reinterpret_cast<const char*>(packet + pos + 1), label_size));
+      pos += 1 + label_size;
+    }
+    return false;
+  }
+
+  std::string to_string() const;
+
+  mdns_name_hash_t hash() const;
+
+  // Case insensitive comparison against a dotted name, e.g. "_foo._tcp.local"
+  bool equals(std::string_view dotted_name) const;
+};
+
+std::ostream& operator<<(std::ostream& sout, const mdns_name_t& name);
+
 // Implement name uncompresion as described in
 // https://tools.ietf.org/html/rfc883#page-31
-std::pair<std::string, size_t> comsume_dns_name(uint8_t* stream, size_t offset);
+//
+// Returns a view of the name that starts at |offset| and the number of bytes
+// it takes at that position, or zero when the name is malformed.
+std::pair<mdns_name_t, size_t> comsume_dns_name(const uint8_t* stream,
+                                                size_t stream_size,
+                                                size_t offset);
+
+// Same as comsume_dns_name(), but returns the hash of the name instead of a
+// view of it, both out of the one walk over its labels
+std::pair<mdns_name_hash_t, size_t> hash_dns_name(const uint8_t* stream,
+                                                  size_t stream_size,
+                                                  size_t offset);
 
 struct mdns_header_t {
   static constexpr auto QUERY_MASK = 0x8000;
@@ -89,7 +174,7 @@ struct mdns_header_t {
 };
 
 struct mdns_query_t {
-  std::string name;  // Variable name, cap it at 256
+  mdns_name_t name;
   uint16_t query_type;
   bool unicast_response;
   uint16_t query_class;
@@ -126,24 +211,67 @@ enum mdns_rr_type : uint16_t {
 
 std::string rr_type_to_string(mdns_rr_type type);
 
-struct mdns_rr_a_t {};
+// Where something sits in the packet a message was decoded from
+struct mdns_span_t {
+  uint16_t offset = 0;
+  uint16_t size = 0;
+};
+
+struct mdns_rr_a_t {
+  uint8_t address[4];
+};
+
+struct mdns_rr_aaaa_t {
+  uint8_t address[16];
+};
+
+// Calls visitor(key, value) for every key=value string of TXT data, RFC 6763
+// §6, with an empty value for a key without '='. Empty strings are skipped.
+// Returns false when a string runs past |size|.
+template <typename entry_visitor>
+bool for_each_txt_entry(const uint8_t* data,
+                        size_t size,
+                        entry_visitor&& visitor) {
+  const uint8_t* end = data + size;
+  while (data < end) {
+    size_t entry_size = *data++;
+    if (entry_size > static_cast<size_t>(end - data)) {
+      return false;
+    }
+
+    std::string_view entry(reinterpret_cast<const char*>(data), entry_size);
+    data += entry_size;
+    if (entry.empty()) {
+      continue;
+    }
+
+    auto separator = entry.find('=');
+    visitor(entry.substr(0, separator),
+            separator == std::string_view::npos ? std::string_view()
+                                                : entry.substr(separator + 1));
+  }
+  return true;
+}
 
 struct mdns_rr_txt_t {
-  using key_type = std::string;
-  using value_type = std::string;
+  using key_type = std::string_view;
+  using value_type = std::string_view;
+
+  const uint8_t* packet = nullptr;
+  mdns_span_t data;
 
-  std::forward_list<std::pair<key_type, value_type>> values;
+  template <typename entry_visitor>
+  void for_each_entry(entry_visitor&& visitor) const {
+    for_each_txt_entry(packet + data.offset, data.size,
+                       std::forward<entry_visitor>(visitor));
+  }
 };
 
 struct mdns_rr_srv_t {
   uint16_t priority;
   uint16_t weight;
   uint16_t port;
-  std::string target;
-
-  size_t get_size() const {
-    return sizeof(priority) + sizeof(weight) + sizeof(port) + target.size();
-  }
+  mdns_name_t target;
 
   void dump(std::ostream& sout) const {
     sout << "| priority: " << priority << std::endl;
@@ -154,21 +282,52 @@ struct mdns_rr_srv_t {
 };
 
 struct mdns_rr_ptr_t {
-  std::string name;
+  mdns_name_t name;
 };
 
+// A record as it sits in the packet it was decoded from: fixed fields, and
+// offsets into the packet for everything else. It owns nothing and copies
+// with a memcpy, so a message costs its section vectors and no more however
+// many records and TXT strings it has.
+//
+// The decoder checks the data against the type once, the accessors for the
+// type of the record can then be used freely.
 struct mdns_rr_t {
-  std::string name;
+  mdns_name_t name;
   mdns_rr_type type;
   bool cache_flush;
   uint16_t rr_class;
   uint32_t ttl;
   uint16_t data_length;
+  uint16_t data_offset;  // Where the data starts in |name.packet|
+
+  // The name in the data of PTR and SRV records, bounded to the data
+  mdns_name_t target;
 
-  using data_type =
-      std::variant<mdns_rr_a_t, mdns_rr_txt_t, mdns_rr_srv_t, mdns_rr_ptr_t>;
+  const uint8_t* data() const { return name.packet + data_offset; }
 
-  data_type data;
+  mdns_rr_ptr_t ptr() const { return mdns_rr_ptr_t{target}; }
+
+  mdns_rr_srv_t srv() const {
+    return mdns_rr_srv_t{read_u16(data()), read_u16(data() + 2),
+                         read_u16(data() + 4), target};
+  }
+
+  mdns_rr_txt_t txt() const {
+    return mdns_rr_txt_t{name.packet, mdns_span_t{data_offset, data_length}};
+  }
+
+  mdns_rr_a_t a() const {
+    mdns_rr_a_t rr_a;
+    std::copy_n(data(), sizeof(rr_a.address), rr_a.address);
+    return rr_a;
+  }
+
+  mdns_rr_aaaa_t aaaa() const {
+    mdns_rr_aaaa_t rr_aaaa;
+    std::copy_n(data(), sizeof(rr_aaaa.address), rr_aaaa.address);
+    return rr_aaaa;
+  }
 
   void dump(std::ostream& sout) const {
     sout << "| name: " << name << std::endl;
@@ -182,26 +341,25 @@ struct mdns_rr_t {
          << " * * * * * * * *|" << std::endl;
 
     switch (type) {
-      case PTR: {
-        mdns_rr_ptr_t rr_ptr = std::get<mdns_rr_ptr_t>(data);
-        sout << "| name: " << rr_ptr.name << std::endl;
-      } break;
-      case TXT: {
-        mdns_rr_txt_t rr_txt = std::get<mdns_rr_txt_t>(data);
-        boost::range::for_each(rr_txt.values, [&sout](const auto& pair) {
-          sout << "|  " << pair.first << " = " << pair.second << std::endl;
+      case PTR:
+        sout << "| name: " << ptr().name << std::endl;
+        break;
+      case TXT:
+        txt().for_each_entry([&sout](auto key, auto value) {
+          sout << "|  " << key << " = " << value << std::endl;
         });
-      } break;
-      case SRV: {
-        auto rr_srv = std::get<mdns_rr_srv_t>(data);
-        rr_srv.dump(sout);
-      } break;
+        break;
+      case SRV:
+        srv().dump(sout);
+        break;
       default:
         break;
     }
   }
 };
 
+static_assert(std::is_trivially_copyable_v<mdns_rr_t>);
+
 struct mdns_message_t {
   mdns_header_t header;
 
@@ -0,0 +1,201 @@
+#include "mdns_message_builder.hpp"
+
+#include <algorithm>
+
+using namespace mmdns::net;
+using namespace mmdns::message;
+
+namespace mmdns::codec {
+
+namespace {
+constexpr size_t MAX_LABEL_SIZE = 63;
+constexpr size_t MAX_NAME_SIZE = 255;
+constexpr size_t MAX_STRING_SIZE = 255;
+constexpr uint16_t CLASS_IN = 1;
+constexpr uint16_t CLASS_TOP_BIT_MASK = 0x8000;
+}  // namespace
+
+mdns_message_builder::mdns_message_builder()
+    : wire_(),
+      table_(),
+      encoder_(wire_, sizeof(wire_), &table_),
+      names_(),
+      names_size_(0),
+      header_() {
+  reset();
+}
+
+void mdns_message_builder::reset() {
+  header_ = mdns_header_t{};
+  header_.flags = mdns_header_t::QUERY_MASK | mdns_header_t::AUTHORATIVE_MASK;
+  encoder_.rewind(0);
+  table_.clear();
+  encoder_.encode_header(header_);
+  names_size_ = 0;
+}
+
+std::optional<mdns_message_builder::name_ref> mdns_message_builder::intern(
+    std::initializer_list<std::string_view> parts) {
+  const size_t start = names_size_;
+  auto fits = [this, start](size_t byte_count) {
+    return sizeof(names_) - names_size_ >= byte_count &&
+           names_size_ - start + byte_count <= MAX_NAME_SIZE;
+  };
+
+  for (auto part : parts) {
+    while (!part.empty()) {
+      auto label_end = part.find('.');
+      auto label = part.substr(0, label_end);
+      part.remove_prefix(label_end == std::string_view::npos ? part.size()
+                                                             : label_end + 1);
+      if (label.empty()) {
+        continue;
+      }
+
+      if (label.size() > MAX_LABEL_SIZE || !fits(1 + label.size())) {
+        names_size_ = start;
+        return std::nullopt;
+      }
+
+      names_[names_size_++] = static_cast<net_stream_data>(label.size());
+      std::copy(label.begin(), label.end(), names_ + names_size_);
+      names_size_ += label.size();
+    }
+  }
+
+  if (!fits(1)) {
+    names_size_ = start;
+    return std::nullopt;
+  }
+
+  names_[names_size_++] = 0;
+  return name_ref{static_cast<uint16_t>(start),
+                  static_cast<uint16_t>(names_size_ - start)};
+}
+
+template <typename data_writer>
+bool mdns_message_builder::add_rr_(section where,
+                                   name_ref owner,
+                                   mdns_rr_type type,
+                                   uint32_t ttl,
+                                   bool cache_flush,
+                                   data_writer&& write_data) {
+  if (where == section::answer && header_.additional_rr_count != 0) {
+    return false;
+  }
+
+  const size_t start = encoder_.get_size();
+  if (!encoder_.encode_labels(names_ + owner.offset) ||
+      !encoder_.encode_u16(type) ||
+      !encoder_.encode_u16(CLASS_IN |
+                           (cache_flush ? CLASS_TOP_BIT_MASK : 0)) ||
+      !encoder_.encode_u32(ttl) || !encoder_.encode_u16(0)) {
+    encoder_.rewind(start);
+    return false;
+  }
+
+  const size_t data_offset = encoder_.get_size();
+  if (!write_data(encoder_)) {
+    encoder_.rewind(start);
+    return false;
+  }
+
+  const uint16_t data_length = encoder_.get_size() - data_offset;
+  wire_[data_offset - 2] = data_length >> 8;
+  wire_[data_offset - 1] = data_length & 0xFF;
+
+  if (where == section::answer) {
+    header_.answer_count++;
+  } else {
+    header_.additional_rr_count++;
+  }
+  return true;
+}
+
+bool mdns_message_builder::add_ptr(section where,
+                                   name_ref owner,
+                                   uint32_t ttl,
+                                   bool cache_flush,
+                                   name_ref target) {
+  return add_rr_(where, owner, PTR, ttl, cache_flush,
+                 [this, target](mdns_message_encoder& encoder) {
+                   return encoder.encode_labels(names_ + target.offset);
+                 });
+}
+
+bool mdns_message_builder::add_srv(section where,
+                                   name_ref owner,
+                                   uint32_t ttl,
+                                   bool cache_flush,
+                                   uint16_t priority,
+                                   uint16_t weight,
+                                   uint16_t port,
+                                   name_ref target) {
+  return add_rr_(
+      where, owner, SRV, ttl, cache_flush,
+      [this, priority, weight, port, target](mdns_message_encoder& encoder) {
+        return encoder.encode_u16(priority) && encoder.encode_u16(weight) &&
+               encoder.encode_u16(port) &&
+               encoder.encode_labels(names_ + target.offset);
+      });
+}
+
+bool mdns_message_builder::add_txt(
+    section where,
+    name_ref owner,
+    uint32_t ttl,
+    bool cache_flush,
+    const std::vector<std::pair<std::string, std::string>>& values) {
+  return add_rr_(where, owner, TXT, ttl, cache_flush,
+                 [&values](mdns_message_encoder& encoder) {
+                   const net_stream_data separator = '=';
+                   if (values.empty()) {
+                     const net_stream_data empty = 0;
+                     return encoder.encode_bytes(&empty, 1);
+                   }
+
+                   for (const auto& [key, value] : values) {
+                     const size_t length = key.size() + 1 + value.size();
+                     const auto size = static_cast<net_stream_data>(length);
+                     if (length > MAX_STRING_SIZE ||
+                         !encoder.encode_bytes(&size, 1) ||
+                         !encoder.encode_bytes(
+                             reinterpret_cast<const_net_stream_pointer>(
+                                 key.data()),
+                             key.size()) ||
+                         !encoder.encode_bytes(&separator, 1) ||
+                         !encoder.encode_bytes(
+                             reinterpret_cast<const_net_stream_pointer>(
+                                 value.data()),
+                             value.size())) {
+                       return false;
+                     }
+                   }
+                   return true;
+                 });
+}
+
+bool mdns_message_builder::add_address(section where,
+                                       name_ref owner,
+                                       uint32_t ttl,
+                                       bool cache_flush,
+                                       const_net_stream_pointer address,
+                                       size_t address_size) {
+  if (address_size != 4 && address_size != 16) {
+    return false;
+  }
+
+  return add_rr_(where, owner, address_size == 4 ? A : AAAA, ttl, cache_flush,
+                 [address, address_size](mdns_message_encoder& encoder) {
+                   return encoder.encode_bytes(address, address_size);
+                 });
+}
+
+std::shared_ptr<const std::vector<net_stream_data>>
+mdns_message_builder::finish() {
+  mdns_message_encoder{wire_, sizeof(wire_)}.encode_header(header_);
+  return std::make_shared<std::vector<net_stream_data>>(
+      wire_, wire_ + encoder_.get_size());
+}
+
+}  // namespace mmdns::codec
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_message_encoder.hpp"
+#include "net/net_steam.hpp"
+
+namespace mmdns::codec {
+
+// Lays the records of a response out in wire format, in a buffer the builder
+// owns and reuses from one response to the next. Names are interned once into
+// a second fixed buffer and written from there, compressed against the names
+// before them, so building a response allocates nothing until finish() hands
+// out the packet.
+//
+// Every add_* call either adds its whole record or nothing and returns false.
+// Answers have to come before additional records.
+class mdns_message_builder {
+ public:
+  enum class section { answer, additional };
+
+  // Where an interned name sits in the name buffer
+  struct name_ref {
+    uint16_t offset;
+    uint16_t size;
+  };
+
+  // Keep responses within an Ethernet frame, RFC 6762 §17
+  static constexpr size_t max_response_size = 1472;
+
+  mdns_message_builder();
+
+  ~mdns_message_builder() = default;
+
+  mdns_message_builder(const mdns_message_builder&) = delete;
+  mdns_message_builder& operator=(const mdns_message_builder&) = delete;
+
+  // Starts over with an empty response and no interned names
+  void reset();
+
+  // Interns the name made of |parts| joined by dots, e.g. an instance name
+  // from its name, type and domain, without building the joined string
+  std::optional<name_ref> intern(std::initializer_list<std::string_view> parts);
+
+  bool add_ptr(section where,
+               name_ref owner,
+               uint32_t ttl,
+               bool cache_flush,
+               name_ref target);
+
+  bool add_srv(section where,
+               name_ref owner,
+               uint32_t ttl,
+               bool cache_flush,
+               uint16_t priority,
+               uint16_t weight,
+               uint16_t port,
+               name_ref target);
+
+  // One key=value string per entry, or the single empty string RFC 6763 §6.1
+  // asks for when there are none
+  bool add_txt(section where,
+               name_ref owner,
+               uint32_t ttl,
+               bool cache_flush,
+               const std::vector<std::pair<std::string, std::string>>& values);
+
+  // An A record for 4 address bytes, an AAAA record for 16
+  bool add_address(section where,
+                   name_ref owner,
+                   uint32_t ttl,
+                   bool cache_flush,
+                   net::const_net_stream_pointer address,
+                   size_t address_size);
+
+  // The response built so far, with the AA bit set
+  std::shared_ptr<const std::vector<net::net_stream_data>> finish();
+
+ private:
+  template <typename data_writer>
+  bool add_rr_(section where,
+               name_ref owner,
+               message::mdns_rr_type type,
+               uint32_t ttl,
+               bool cache_flush,
+               data_writer&& write_data);
+
+  net::net_stream_data wire_[max_response_size];
+  compression_table table_;
+  mdns_message_encoder encoder_;
+  net::net_stream_data names_[1024];
+  size_t names_size_;
+  message::mdns_header_t header_;
+};
+
+}  // namespace mmdns::codec
@@ -0,0 +1,214 @@
+#include "mdns_message_decoder.hpp"
+
+using namespace mmdns::net;
+using namespace mmdns::message;
+
+namespace mmdns::codec {
+
+namespace {
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t QUERY_FIELDS_SIZE = 4;
+constexpr size_t RR_FIELDS_SIZE = 10;
+// Root name plus the fixed fields, the least a query or a RR can take
+constexpr size_t MIN_QUERY_SIZE = 1 + QUERY_FIELDS_SIZE;
+constexpr size_t MIN_RR_SIZE = 1 + RR_FIELDS_SIZE;
+constexpr uint16_t CLASS_TOP_BIT_MASK = 0x8000;
+}  // namespace
+
+const char* to_string(decode_error error) {
+  switch (error) {
+    case decode_error::none:
+      return "none";
+    case decode_error::truncated_header:
+      return "truncated header";
+    case decode_error::bad_counts:
+      return "bad section counts";
+    case decode_error::bad_name:
+      return "bad name";
+    case decode_error::truncated_question:
+      return "truncated question";
+    case decode_error::truncated_rr:
+      return "truncated RR";
+    case decode_error::bad_rr_data:
+      return "bad RR data";
+  }
+  return "unknown";
+}
+
+mdns_message_decoder::mdns_message_decoder(mdns_message_t& message)
+    : message_(message) {}
+
+decode_result mdns_message_decoder::decode(net_stream& stream) {
+  auto fail = [&stream](decode_error error) {
+    return decode_result{error, stream.get_bytes_read()};
+  };
+
+  if (auto error = decode_header(stream); error != decode_error::none) {
+    return fail(error);
+  }
+
+  const auto& header = message_.header;
+  message_.queries.resize(header.question_count);
+  for (auto& query : message_.queries) {
+    if (auto error = decode_query(stream, query);
+        error != decode_error::none) {
+      return fail(error);
+    }
+  }
+
+  for (auto [section, count] :
+       {std::make_pair(&message_.answers, header.answer_count),
+        std::make_pair(&message_.authorities, header.authority_rr_count),
+        std::make_pair(&message_.additionals, header.additional_rr_count)}) {
+    section->resize(count);
+    for (auto& rr : *section) {
+      if (auto error = decode_rr(stream, rr); error != decode_error::none) {
+        return fail(error);
+      }
+    }
+  }
+
+  return decode_result{decode_error::none, stream.get_bytes_read()};
+}
+
+decode_error mdns_message_decoder::decode_header(net_stream& stream) {
+  auto [status, ptr, end] = stream.read(HEADER_SIZE);
+  if (!status) {
+    return decode_error::truncated_header;
+  }
+
+  auto& header = message_.header;
+  consume(16, ptr, header.id);
+  consume(16, ptr, header.flags);
+  consume(16, ptr, header.question_count);
+  consume(16, ptr, header.answer_count);
+  consume(16, ptr, header.authority_rr_count);
+  consume(16, ptr, header.additional_rr_count);
+
+  // Don't let the counts in a bogus header size our vectors
+  const size_t rr_count = header.answer_count + header.authority_rr_count +
+                          header.additional_rr_count;
+  if (header.question_count * MIN_QUERY_SIZE + rr_count * MIN_RR_SIZE >
+      stream.get_size() - stream.get_bytes_read()) {
+    return decode_error::bad_counts;
+  }
+  return decode_error::none;
+}
+
+decode_error mdns_message_decoder::decode_name(net_stream& stream,
+                                               mdns_name_t& name) {
+  auto [status, base] = stream.seek(0);
+  if (!status) {
+    return decode_error::bad_name;
+  }
+
+  auto [decoded_name, name_size] =
+      comsume_dns_name(base, stream.get_size(), stream.get_bytes_read());
+  if (name_size == 0 || !std::get<0>(stream.read(name_size))) {
+    return decode_error::bad_name;
+  }
+
+  name = decoded_name;
+  return decode_error::none;
+}
+
+decode_error mdns_message_decoder::decode_query(net_stream& stream,
+                                                mdns_query_t& query) {
+  if (auto error = decode_name(stream, query.name);
+      error != decode_error::none) {
+    return error;
+  }
+
+  auto [status, ptr, end] = stream.read(QUERY_FIELDS_SIZE);
+  if (!status) {
+    return decode_error::truncated_question;
+  }
+
+  consume(16, ptr, query.query_type);
+  consume(16, ptr, query.query_class);
+  query.unicast_response = (query.query_class & CLASS_TOP_BIT_MASK) != 0;
+  query.query_class &= ~CLASS_TOP_BIT_MASK;
+  return decode_error::none;
+}
+
+decode_error mdns_message_decoder::decode_rr(net_stream& stream,
+                                             mdns_rr_t& rr) {
+  if (auto error = decode_name(stream, rr.name); error != decode_error::none) {
+    return error;
+  }
+
+  auto [status, ptr, end] = stream.read(RR_FIELDS_SIZE);
+  if (!status) {
+    return decode_error::truncated_rr;
+  }
+
+  uint16_t type;
+  consume(16, ptr, type);
+  rr.type = static_cast<mdns_rr_type>(type);
+  consume(16, ptr, rr.rr_class);
+  rr.cache_flush = (rr.rr_class & CLASS_TOP_BIT_MASK) != 0;
+  rr.rr_class &= ~CLASS_TOP_BIT_MASK;
+  consume(32, ptr, rr.ttl);
+  consume(16, ptr, rr.data_length);
+
+  return decode_rr_data(stream, rr);
+}
+
+decode_error mdns_message_decoder::decode_rr_data(net_stream& stream,
+                                                  mdns_rr_t& rr) {
+  const size_t data_offset = stream.get_bytes_read();
+  auto [status, ptr, end] = stream.read(rr.data_length);
+  if (!status) {
+    return decode_error::truncated_rr;
+  }
+
+  // Names in the data may point anywhere before their own end
+  auto [base_status, base] = stream.seek(0);
+  if (!base_status) {
+    return decode_error::truncated_rr;
+  }
+
+  rr.data_offset = data_offset;
+
+  auto name_at = [&](size_t offset, mdns_name_t& name) {
+    auto [decoded_name, name_size] =
+        comsume_dns_name(base, data_offset + rr.data_length, offset);
+    name = decoded_name;
+    return name_size != 0;
+  };
+
+  rr.target = mdns_name_t{};
+  switch (rr.type) {
+    case PTR:
+      if (!name_at(data_offset, rr.target)) {
+        return decode_error::bad_name;
+      }
+      break;
+    case SRV:
+      if (rr.data_length < 6) {
+        return decode_error::bad_rr_data;
+      }
+      if (!name_at(data_offset + 6, rr.target)) {
+        return decode_error::bad_name;
+      }
+      break;
+    case TXT:
+      if (!for_each_txt_entry(ptr, rr.data_length,
+                              [](std::string_view, std::string_view) {})) {
+        return decode_error::bad_rr_data;
+      }
+      break;
+    case A:
+    case AAAA:
+      if (rr.data_length != (rr.type == A ? 4 : 16)) {
+        return decode_error::bad_rr_data;
+      }
+      break;
+    default:
+      break;
+  }
+
+  return decode_error::none;
+}
+
+}  // namespace mmdns::codec
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+#include "mdns_message.hpp"
+#include "net/net_steam.hpp"
+
+namespace mmdns::codec {
+
+enum class decode_error : uint8_t {
+  none,
+  // Shorter than the 12 byte header
+  truncated_header,
+  // More questions and records than the packet has room for
+  bad_counts,
+  // A name running past the packet, pointing forwards or in circles, with
+  // too many pointers, or longer than 255 bytes
+  bad_name,
+  // Fixed fields or data running past the packet
+  truncated_question,
+  truncated_rr,
+  // Data that doesn't parse as its type says it should
+  bad_rr_data,
+};
+
+const char* to_string(decode_error error);
+
+// What came of decoding a packet, and where in it decoding stopped
+struct decode_result {
+  decode_error error = decode_error::none;
+  size_t offset = 0;
+
+  explicit operator bool() const { return error == decode_error::none; }
+};
+
+// Decodes a packet straight out of the net_stream buffer. Names, TXT entries
+// and the like are views into that buffer, so the decoded message must not
+// outlive it.
+//
+// Every size, count and pointer is checked against the buffer before it is
+// used, and nothing throws: a malformed packet comes back as an error.
+class mdns_message_decoder {
+ public:
+  mdns_message_decoder(message::mdns_message_t& message);
+
+  ~mdns_message_decoder() = default;
+
+  decode_result decode(net::net_stream& stream);
+
+ private:
+  decode_error decode_header(net::net_stream& stream);
+  decode_error decode_name(net::net_stream& stream,
+                           message::mdns_name_t& name);
+  decode_error decode_query(net::net_stream& stream,
+                            message::mdns_query_t& query);
+  decode_error decode_rr(net::net_stream& stream, message::mdns_rr_t& rr);
+  decode_error decode_rr_data(net::net_stream& stream,
+                              message::mdns_rr_t& rr);
+
+  message::mdns_message_t& message_;
+};
+
+}  // namespace mmdns::codec
@@ -0,0 +1,386 @@
+#include "mdns_message_encoder.hpp"
+
+#include <cstring>
+
+using namespace mmdns::net;
+using namespace mmdns::message;
+
+namespace mmdns::codec {
+
+namespace {
+constexpr size_t MAX_LABEL_SIZE = 63;
+constexpr size_t MAX_NAME_SIZE = 255;
+constexpr size_t MAX_LABEL_COUNT = 128;
+constexpr uint16_t CLASS_TOP_BIT_MASK = 0x8000;
+constexpr uint16_t POINTER_BITS = 0xC000;
+// Pointers have 14 bits for the offset
+constexpr size_t MAX_POINTER_OFFSET = 0x3FFF;
+
+constexpr uint32_t FNV_OFFSET_BASIS = 2166136261u;
+constexpr uint32_t FNV_PRIME = 16777619u;
+
+// FNV-1a over a label, size byte included, chained from the hash of the
+// suffix that follows it
+uint32_t hash_label(uint32_t hash, const_net_stream_pointer label) {
+  for (size_t idx = 0; idx <= label[0]; idx++) {
+    hash = (hash ^ label[idx]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+// Whether the name at |offset| in |packet|, following any pointer in it, is
+// byte for byte the uncompressed |name|
+bool same_name(const_net_stream_pointer packet,
+               size_t packet_size,
+               size_t offset,
+               const_net_stream_pointer name) {
+  size_t hops = 0;
+  while (offset < packet_size) {
+    const auto label_size = packet[offset];
+    if ((label_size & mdns_name_t::POINTER_MASK) ==
+        mdns_name_t::POINTER_MASK) {
+      if (offset + 1 >= packet_size ||
+          ++hops > mdns_name_t::MAX_POINTER_HOPS) {
+        return false;
+      }
+      offset = read_u16(packet + offset) & MAX_POINTER_OFFSET;
+      continue;
+    }
+
+    if (label_size != name[0]) {
+      return false;
+    }
+    if (label_size == 0) {
+      return true;
+    }
+    if (offset + 1 + label_size > packet_size ||
+        memcmp(packet + offset + 1, name + 1, label_size) != 0) {
+      return false;
+    }
+
+    offset += 1 + label_size;
+    name += 1 + label_size;
+  }
+  return false;
+}
+}  // namespace
+
+void compression_table::clear() {
+  for (size_t idx = 0; idx < size_; idx++) {
+    slots_[entries_[idx].slot] = 0;
+  }
+  size_ = 0;
+}
+
+uint16_t compression_table::find(const_net_stream_pointer packet,
+                                 size_t packet_size,
+                                 const_net_stream_pointer suffix,
+                                 uint32_t hash) const {
+  for (size_t slot = hash % slot_count; slots_[slot] != 0;
+       slot = (slot + 1) % slot_count) {
+    const auto& candidate = entries_[slots_[slot] - 1];
+    if (candidate.hash == hash &&
+        same_name(packet, packet_size, candidate.offset, suffix)) {
+      return candidate.offset;
+    }
+  }
+  return 0;
+}
+
+void compression_table::insert(uint32_t hash, uint16_t offset) {
+  if (size_ == max_entries) {
+    return;
+  }
+
+  size_t slot = hash % slot_count;
+  while (slots_[slot] != 0) {
+    slot = (slot + 1) % slot_count;
+  }
+
+  entries_[size_] = {hash, offset, static_cast<uint8_t>(slot)};
+  slots_[slot] = static_cast<uint8_t>(++size_);
+}
+
+void compression_table::truncate(size_t offset) {
+  while (size_ > 0 && entries_[size_ - 1].offset >= offset) {
+    slots_[entries_[--size_].slot] = 0;
+  }
+}
+
+mdns_message_encoder::mdns_message_encoder(net_stream_pointer ptr,
+                                           size_t ptr_size,
+                                           compression_table* names)
+    : ptr_(ptr), capacity_(ptr_size), size_(0), names_(names) {}
+
+bool mdns_message_encoder::encode_header(const mdns_header_t& header) {
+  if (!has_room(12)) {
+    return false;
+  }
+
+  encode_u16(header.id);
+  encode_u16(header.flags);
+  encode_u16(header.question_count);
+  encode_u16(header.answer_count);
+  encode_u16(header.authority_rr_count);
+  encode_u16(header.additional_rr_count);
+  return true;
+}
+
+bool mdns_message_encoder::encode_name(std::string_view dotted_name) {
+  if (names_ != nullptr) {
+    // Laid out uncompressed first, then compressed like any other name
+    net_stream_data labels[MAX_NAME_SIZE];
+    mdns_message_encoder plain{labels, sizeof(labels)};
+    return plain.encode_name(dotted_name) && encode_labels(labels);
+  }
+
+  const size_t start = size_;
+  while (!dotted_name.empty()) {
+    auto label_end = dotted_name.find('.');
+    auto label = dotted_name.substr(0, label_end);
+    dotted_name.remove_prefix(label_end == std::string_view::npos
+                                  ? dotted_name.size()
+                                  : label_end + 1);
+    if (label.empty()) {
+      continue;
+    }
+
+    if (label.size() > MAX_LABEL_SIZE || !has_room(1 + label.size())) {
+      size_ = start;
+      return false;
+    }
+
+    ptr_[size_++] = static_cast<net_stream_data>(label.size());
+    encode_bytes(reinterpret_cast<const_net_stream_pointer>(label.data()),
+                 label.size());
+  }
+
+  if (!has_room(1)) {
+    size_ = start;
+    return false;
+  }
+
+  ptr_[size_++] = 0;
+  return true;
+}
+
+bool mdns_message_encoder::encode_name(const mdns_name_t& name) {
+  const size_t start = size_;
+  bool fits = true;
+  bool valid = name.for_each_label([&](std::string_view label) {
+    if (fits && has_room(1 + label.size())) {
+      ptr_[size_++] = static_cast<net_stream_data>(label.size());
+      encode_bytes(reinterpret_cast<const_net_stream_pointer>(label.data()),
+                   label.size());
+    } else {
+      fits = false;
+    }
+  });
+
+  if (!valid || !fits || !has_room(1)) {
+    size_ = start;
+    return false;
+  }
+
+  ptr_[size_++] = 0;
+  return true;
+}
+
+bool mdns_message_encoder::encode_labels(const_net_stream_pointer labels) {
+  // Where each label starts, and the hash of the suffix starting there
+  const_net_stream_pointer starts[MAX_LABEL_COUNT];
+  uint32_t hashes[MAX_LABEL_COUNT];
+  size_t label_count = 0;
+
+  auto end = labels;
+  for (; *end != 0; end += 1 + *end) {
+    if (label_count == MAX_LABEL_COUNT || *end > MAX_LABEL_SIZE) {
+      return false;
+    }
+    starts[label_count++] = end;
+  }
+
+  const size_t name_size = end - labels + 1;
+  if (name_size > MAX_NAME_SIZE) {
+    return false;
+  }
+
+  // The longest suffix already in the packet, if any
+  size_t matched = label_count;
+  uint16_t pointer = 0;
+  if (names_ != nullptr) {
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (size_t idx = label_count; idx-- > 0;) {
+      hash = hash_label(hash, starts[idx]);
+      hashes[idx] = hash;
+    }
+
+    for (size_t idx = 0; idx < label_count && pointer == 0; idx++) {
+      pointer = names_->find(ptr_, size_, starts[idx], hashes[idx]);
+      matched = idx;
+    }
+    if (pointer == 0) {
+      matched = label_count;
+    }
+  }
+
+  const size_t prefix_size =
+      matched == label_count ? name_size : starts[matched] - labels;
+  if (!has_room(prefix_size + (pointer != 0 ? 2 : 0))) {
+    return false;
+  }
+
+  const size_t start = size_;
+  encode_bytes(labels, prefix_size);
+  if (pointer != 0) {
+    encode_u16(POINTER_BITS | pointer);
+  }
+
+  if (names_ != nullptr) {
+    for (size_t idx = 0; idx < matched; idx++) {
+      const size_t offset = start + (starts[idx] - labels);
+      if (offset <= MAX_POINTER_OFFSET) {
+        names_->insert(hashes[idx], static_cast<uint16_t>(offset));
+      }
+    }
+  }
+  return true;
+}
+
+bool mdns_message_encoder::encode_question(std::string_view dotted_name,
+                                           uint16_t type,
+                                           uint16_t rr_class) {
+  const size_t start = size_;
+  if (!encode_name(dotted_name) || !has_room(4)) {
+    rewind(start);
+    return false;
+  }
+
+  encode_u16(type);
+  encode_u16(rr_class);
+  return true;
+}
+
+bool mdns_message_encoder::encode_rr(const mdns_rr_t& rr) {
+  const size_t start = size_;
+  auto fail = [this, start]() {
+    size_ = start;
+    return false;
+  };
+
+  if (!encode_name(rr.name) || !has_room(10)) {
+    return fail();
+  }
+
+  encode_u16(rr.type);
+  encode_u16(rr.rr_class | (rr.cache_flush ? CLASS_TOP_BIT_MASK : 0));
+  encode_u32(rr.ttl);
+
+  // The length is only known once the names in the data are expanded
+  const size_t data_length_offset = size_;
+  encode_u16(0);
+
+  bool encoded = false;
+  switch (rr.type) {
+    case PTR:
+      encoded = encode_name(rr.ptr().name);
+      break;
+    case SRV: {
+      const auto rr_srv = rr.srv();
+      encoded = has_room(6) && encode_u16(rr_srv.priority) &&
+                encode_u16(rr_srv.weight) && encode_u16(rr_srv.port) &&
+                encode_name(rr_srv.target);
+    } break;
+    default:
+      encoded = encode_bytes(rr.data(), rr.data_length);
+      break;
+  }
+
+  if (!encoded) {
+    return fail();
+  }
+
+  const uint16_t data_length = size_ - data_length_offset - 2;
+  ptr_[data_length_offset] = data_length >> 8;
+  ptr_[data_length_offset + 1] = data_length & 0xFF;
+  return true;
+}
+
+bool mdns_message_encoder::encode_rr(const_net_stream_pointer wire,
+                                     size_t wire_size,
+                                     uint16_t data_offset,
+                                     uint32_t ttl) {
+  const size_t start = size_;
+  // Type and class sit right after the owner name
+  auto fixed = wire + data_offset - 10;
+  if (!encode_labels(wire) || !encode_bytes(fixed, 4) || !encode_u32(ttl) ||
+      !encode_u16(0)) {
+    rewind(start);
+    return false;
+  }
+
+  const size_t data_start = size_;
+  auto data = wire + data_offset;
+  bool encoded = false;
+  switch (read_u16(fixed)) {
+    case PTR:
+      encoded = encode_labels(data);
+      break;
+    case SRV:
+      encoded = encode_bytes(data, 6) && encode_labels(data + 6);
+      break;
+    default:
+      encoded = encode_bytes(data, wire_size - data_offset);
+      break;
+  }
+
+  if (!encoded) {
+    rewind(start);
+    return false;
+  }
+
+  const uint16_t data_length = size_ - data_start;
+  ptr_[data_start - 2] = data_length >> 8;
+  ptr_[data_start - 1] = data_length & 0xFF;
+  return true;
+}
+
+void mdns_message_encoder::rewind(size_t size) {
+  size_ = size;
+  if (names_ != nullptr) {
+    names_->truncate(size);
+  }
+}
+
+bool mdns_message_encoder::encode_u16(uint16_t value) {
+  if (!has_room(2)) {
+    return false;
+  }
+
+  ptr_[size_++] = value >> 8;
+  ptr_[size_++] = value & 0xFF;
+  return true;
+}
+
+bool mdns_message_encoder::encode_u32(uint32_t value) {
+  if (!has_room(4)) {
+    return false;
+  }
+
+  encode_u16(value >> 16);
+  encode_u16(value & 0xFFFF);
+  return true;
+}
+
+bool mdns_message_encoder::encode_bytes(const_net_stream_pointer data,
+                                        size_t data_size) {
+  if (!has_room(data_size)) {
+    return false;
+  }
+
+  memcpy(ptr_ + size_, data, data_size);
+  size_ += data_size;
+  return true;
+}
+
+}  // namespace mmdns::codec
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "mdns_message.hpp"
+#include "net/net_steam.hpp"
+
+namespace mmdns::codec {
+
+// Where the names already written to a packet are, by the hash of each of
+// their suffixes, so that later names can point back at them (RFC 1035
+// §4.1.4). Fixed size: once it is full, names are still written, just not
+// remembered.
+class compression_table {
+ public:
+  compression_table() : slots_(), entries_(), size_(0) {}
+
+  void clear();
+
+  // Offset of a name in |packet| equal to the uncompressed |suffix| that
+  // hashes to |hash|, or 0 when there is none
+  uint16_t find(net::const_net_stream_pointer packet,
+                size_t packet_size,
+                net::const_net_stream_pointer suffix,
+                uint32_t hash) const;
+
+  void insert(uint32_t hash, uint16_t offset);
+
+  // Forgets the names from |offset| on. Entries go in offset order, so they
+  // come out the same way and the probe chains stay intact.
+  void truncate(size_t offset);
+
+ private:
+  static constexpr size_t slot_count = 256;
+  static constexpr size_t max_entries = 128;
+
+  struct entry {
+    uint32_t hash;
+    uint16_t offset;
+    uint8_t slot;
+  };
+
+  // Index into |entries_| plus one, zero when the slot is free
+  uint8_t slots_[slot_count];
+  entry entries_[max_entries];
+  size_t size_;
+};
+
+// Writes wire format into a caller owned buffer. Every encode_* call either
+// writes all of its bytes or none of them and returns false, so a caller can
+// stop at the first record that doesn't fit.
+//
+// Given a compression table, names are compressed against the ones written
+// before them. |ptr| has to be the start of the packet then, the offsets in
+// the pointers are relative to it.
+class mdns_message_encoder {
+ public:
+  mdns_message_encoder(net::net_stream_pointer ptr,
+                       size_t ptr_size,
+                       compression_table* names = nullptr);
+
+  ~mdns_message_encoder() = default;
+
+  bool encode_header(const message::mdns_header_t& header);
+
+  bool encode_name(std::string_view dotted_name);
+  bool encode_name(const message::mdns_name_t& name);
+  // An uncompressed name as it is on the wire, labels up to the root
+  bool encode_labels(net::const_net_stream_pointer labels);
+
+  bool encode_question(std::string_view dotted_name,
+                       uint16_t type,
+                       uint16_t rr_class);
+
+  // Re-encodes a decoded RR with every name in it uncompressed, so the bytes
+  // can be copied into any other packet as they are
+  bool encode_rr(const message::mdns_rr_t& rr);
+
+  // Copies an RR kept in uncompressed wire format, with its data starting at
+  // |data_offset|, and with |ttl| in place of its own. The owner name and the
+  // names in PTR and SRV data are compressed, RFC 6762 §18.14.
+  bool encode_rr(net::const_net_stream_pointer wire,
+                 size_t wire_size,
+                 uint16_t data_offset,
+                 uint32_t ttl);
+
+  bool encode_u16(uint16_t value);
+  bool encode_u32(uint32_t value);
+  bool encode_bytes(net::const_net_stream_pointer data, size_t data_size);
+
+  size_t get_size() const { return size_; }
+
+  // Drops everything written from |size| on
+  void rewind(size_t size);
+
+ private:
+  bool has_room(size_t byte_count) const {
+    return capacity_ - size_ >= byte_count;
+  }
+
+  net::net_stream_pointer ptr_;
+  const size_t capacity_;
+  size_t size_;
+  compression_table* names_;
+};
+
+}  // namespace mmdns::codec
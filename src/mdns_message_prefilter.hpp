@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+
+#include "mdns_message.hpp"
+#include "net/net_steam.hpp"
+
+namespace mmdns::codec {
+
+// A first look at a packet, to drop the ones nobody here needs before paying
+// for a full decode. Reads the header and the question names where they sit
+// in the buffer, with the same bounds checks the decoder makes, and allocates
+// nothing.
+class mdns_message_prefilter {
+ public:
+  mdns_message_prefilter(net::const_net_stream_pointer data, size_t data_size)
+      : data_(data), data_size_(data_size), header_() {}
+
+  ~mdns_message_prefilter() = default;
+
+  bool read_header() {
+    if (data_size_ < HEADER_SIZE) {
+      return false;
+    }
+
+    header_.id = message::read_u16(data_);
+    header_.flags = message::read_u16(data_ + 2);
+    header_.question_count = message::read_u16(data_ + 4);
+    header_.answer_count = message::read_u16(data_ + 6);
+    header_.authority_rr_count = message::read_u16(data_ + 8);
+    header_.additional_rr_count = message::read_u16(data_ + 10);
+    return true;
+  }
+
+  // Only valid once read_header() succeeded
+  const message::mdns_header_t& header() const { return header_; }
+
+  // Whether matches(mdns_name_hash_t) holds for the hash of any question name,
+  // stopping at the first that does. False as well when the questions are
+  // malformed.
+  template <typename hash_predicate>
+  bool any_question(hash_predicate&& matches) const {
+    size_t offset = HEADER_SIZE;
+    for (size_t idx = 0; idx < header_.question_count; idx++) {
+      auto [hash, name_size] =
+          message::hash_dns_name(data_, data_size_, offset);
+      if (name_size == 0 ||
+          data_size_ - offset < name_size + QUERY_FIELDS_SIZE) {
+        return false;
+      }
+
+      if (matches(hash)) {
+        return true;
+      }
+      offset += name_size + QUERY_FIELDS_SIZE;
+    }
+    return false;
+  }
+
+ private:
+  static constexpr size_t HEADER_SIZE = 12;
+  static constexpr size_t QUERY_FIELDS_SIZE = 4;
+
+  net::const_net_stream_pointer data_;
+  const size_t data_size_;
+  message::mdns_header_t header_;
+};
+
+}  // namespace mmdns::codec
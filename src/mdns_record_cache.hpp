@@ -0,0 +1,161 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_service_register.hpp"
+
+namespace mmdns::client {
+
+// A record some host on the link answered with, and how long it has left
+struct cached_record {
+  std::shared_ptr<const service::record> rr;
+  uint32_t ttl;
+};
+
+// Records learnt from the responses seen on the network, so that lookups can
+// be answered from memory. Responses are fed from any thread; lookups take a
+// shared lock and never wait on each other.
+class record_cache {
+ public:
+  using clock = detail::clock;
+
+  record_cache() : mutex_(), entries_(), last_sweep_(clock::now()) {}
+
+  // Caches the answers and additional records of |response|. A record with
+  // the cache-flush bit set replaces the others of its name, type and class,
+  // except those received within the last second, which are likely part of
+  // the same answer spread over several packets (RFC 6762 §10.2). The records
+  // are copied out of the packet together, into a single block.
+  void insert(const message::mdns_message_t& response,
+              clock::time_point now = clock::now()) {
+    auto received = service::record::from_rrs(
+        {&response.answers, &response.additionals},
+        [](const message::mdns_rr_t& rr) { return rr.rr_class == CLASS_IN; });
+
+    if (received.empty()) {
+      return;
+    }
+
+    std::unique_lock lock(mutex_);
+    for (auto& rr : received) {
+      insert_(std::move(rr), now);
+    }
+
+    if (now - last_sweep_ >= sweep_interval) {
+      sweep_(now);
+    }
+  }
+
+  // Calls visitor(const cached_record&) for every live record owned by the
+  // dotted |name| of the given type, or of every type for ANY
+  template <typename record_visitor>
+  void for_each_record(std::string_view name,
+                       message::mdns_rr_type type,
+                       record_visitor&& visitor,
+                       clock::time_point now = clock::now()) const {
+    std::shared_lock lock(mutex_);
+    auto itr = entries_.find(message::hash_dns_name(name));
+    if (itr == entries_.end()) {
+      return;
+    }
+
+    for (const auto& cached : itr->second) {
+      if (cached.expires > now &&
+          (type == message::ANY || cached.rr->type == type) &&
+          message::dns_name_equals(name, cached.rr->name)) {
+        auto left = std::chrono::ceil<std::chrono::seconds>(
+            cached.expires - now);
+        visitor(cached_record{cached.rr, static_cast<uint32_t>(left.count())});
+      }
+    }
+  }
+
+  std::vector<cached_record> lookup(
+      std::string_view name,
+      message::mdns_rr_type type = message::ANY,
+      clock::time_point now = clock::now()) const {
+    std::vector<cached_record> found;
+    for_each_record(
+        name, type,
+        [&found](const cached_record& cached) { found.push_back(cached); },
+        now);
+    return found;
+  }
+
+ private:
+  struct entry {
+    std::shared_ptr<const service::record> rr;
+    clock::time_point received;
+    clock::time_point expires;
+  };
+
+  void insert_(std::shared_ptr<const service::record>&& rr,
+               clock::time_point now) {
+    auto& entries = entries_[rr->name_hash];
+
+    if (rr->cache_flush) {
+      for (auto& cached : entries) {
+        if (now - cached.received > flush_grace &&
+            !cached.rr->same_record(*rr) && cached.rr->type == rr->type &&
+            cached.rr->rr_class == rr->rr_class &&
+            message::dns_name_equals(cached.rr->name, rr->name)) {
+          cached.expires = std::min(cached.expires, now + flush_grace);
+        }
+      }
+    }
+
+    auto itr = std::find_if(entries.begin(), entries.end(),
+                            [&rr](const entry& cached) {
+                              return cached.rr->same_record(*rr);
+                            });
+
+    // A goodbye leaves the record a second to live, RFC 6762 §10.1
+    auto expires = rr->ttl == 0 ? now + flush_grace
+                                : now + std::chrono::seconds(rr->ttl);
+    if (itr != entries.end()) {
+      itr->rr = std::move(rr);
+      itr->received = now;
+      itr->expires = expires;
+    } else if (rr->ttl != 0) {
+      entries.push_back(entry{std::move(rr), now, expires});
+    }
+  }
+
+  void sweep_(clock::time_point now) {
+    for (auto itr = entries_.begin(); itr != entries_.end();) {
+      auto& entries = itr->second;
+      entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                   [now](const entry& cached) {
+                                     return cached.expires <= now;
+                                   }),
+                    entries.end());
+      itr = entries.empty() ? entries_.erase(itr) : std::next(itr);
+    }
+    last_sweep_ = now;
+  }
+
+  struct name_hash_identity {
+    size_t operator()(message::mdns_name_hash_t hash) const { return hash; }
+  };
+
+  static constexpr uint16_t CLASS_IN = 1;
+  static constexpr auto flush_grace = std::chrono::seconds(1);
+  static constexpr auto sweep_interval = std::chrono::seconds(10);
+
+  mutable std::shared_mutex mutex_;
+  std::unordered_map<message::mdns_name_hash_t,
+                     std::vector<entry>,
+                     name_hash_identity>
+      entries_;
+  clock::time_point last_sweep_;
+};
+
+}  // namespace mmdns::client
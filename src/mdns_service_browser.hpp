@@ -0,0 +1,277 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "detail/name_kernels.hpp"
+#include "mdns_message.hpp"
+#include "mdns_record_cache.hpp"
+#include "mdns_service_query.hpp"
+
+namespace mmdns::client {
+
+// Keeps track of the instances of the service types being browsed and only
+// reports changes. Instances are learnt from every response seen on the link,
+// whoever asked; our own PTR queries back off exponentially and carry the
+// instances we already know, so once the set is stable hardly anything goes
+// out but the refresh of records about to expire (RFC 6762 §5.2, §7.1).
+//
+// Not thread safe, every call but browse(), stop() and on_response() has to
+// come through |strand|. Handlers are called on it.
+class browser {
+ public:
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using send_handler =
+      std::function<void(const endpoint&, std::vector<packet>&&)>;
+  using instance_handler = std::function<void(const std::string&)>;
+  using clock = detail::clock;
+
+  browser(boost::asio::io_context& io_ctx,
+          boost::asio::io_context::strand& strand,
+          const record_cache& cache,
+          const endpoint& destination,
+          send_handler handler)
+      : io_ctx_(io_ctx),
+        strand_(strand),
+        cache_(cache),
+        destination_(destination),
+        send_handler_(std::move(handler)),
+        gen_(detail::random_seed()),
+        next_id_(1),
+        browse_count_(0),
+        browses_() {}
+
+  ~browser() = default;
+
+  // Starts browsing for instances of |service_type|, e.g. _http._tcp.local.
+  // Instances already in the cache are reported right away. Returns the id
+  // to stop() with.
+  size_t browse(const std::string& service_type,
+                instance_handler on_added,
+                instance_handler on_removed) {
+    auto id = next_id_++;
+    browse_count_++;
+    strand_.post([this, id, service_type, on_added = std::move(on_added),
+                  on_removed = std::move(on_removed)]() mutable {
+      auto entry = std::make_unique<browse_state>(io_ctx_);
+      entry->service_type = service_type;
+      entry->on_added = std::move(on_added);
+      entry->on_removed = std::move(on_removed);
+      auto& started = *browses_.emplace(id, std::move(entry)).first->second;
+
+      auto now = clock::now();
+      cache_.for_each_record(
+          service_type, message::PTR, [&](const cached_record& cached) {
+            track_(started, std::string(cached.rr->target), cached.ttl, now);
+          });
+
+      // Like any query at startup, the first goes out after 20-120 ms
+      std::uniform_int_distribution<> delay(20, 120);
+      started.next_query = now + std::chrono::milliseconds(delay(gen_));
+      arm_(id, started);
+    });
+    return id;
+  }
+
+  void stop(size_t id) {
+    strand_.post([this, id]() {
+      if (browses_.erase(id) != 0) {
+        browse_count_--;
+      }
+    });
+  }
+
+  bool is_browsing() const { return browse_count_ > 0; }
+
+  // |packet| keeps the buffer the names in |response| point into alive
+  void on_response(std::shared_ptr<const void> packet,
+                   const message::mdns_message_t& response) {
+    if (!is_browsing()) {
+      return;
+    }
+
+    strand_.post([this, packet = std::move(packet), response]() {
+      auto now = clock::now();
+      std::vector<size_t> touched;
+      auto learn = [this, now, &touched](const message::mdns_rr_t& rr) {
+        if (rr.type != message::PTR) {
+          return;
+        }
+
+        for (auto& [id, entry] : browses_) {
+          if (rr.name.equals(entry->service_type)) {
+            auto instance = rr.ptr().name.to_string();
+            track_(*entry, instance, rr.ttl, now);
+            touched.push_back(id);
+          }
+        }
+      };
+      std::for_each(response.answers.begin(), response.answers.end(), learn);
+      std::for_each(response.additionals.begin(), response.additionals.end(),
+                    learn);
+
+      std::sort(touched.begin(), touched.end());
+      touched.erase(std::unique(touched.begin(), touched.end()),
+                    touched.end());
+      for (auto id : touched) {
+        arm_(id, *browses_[id]);
+      }
+    });
+  }
+
+ private:
+  struct instance {
+    std::string name;
+    clock::time_point received;
+    uint32_t ttl;
+    // Queries sent to refresh this instance so far
+    uint8_t refreshes;
+
+    clock::time_point expires() const {
+      return received + std::chrono::seconds(ttl);
+    }
+
+    // We ask again at 80% and 90% of the TTL before letting it go
+    clock::time_point refresh_at() const {
+      return received +
+             std::chrono::milliseconds(ttl * (800 + 100 * refreshes));
+    }
+  };
+
+  struct browse_state {
+    browse_state(boost::asio::io_context& io_ctx) : timer(io_ctx) {}
+
+    std::string service_type;
+    instance_handler on_added;
+    instance_handler on_removed;
+    // By lowercased instance name
+    std::unordered_map<std::string, instance> instances;
+
+    clock::time_point next_query;
+    std::chrono::seconds interval = std::chrono::seconds(1);
+    detail::timer timer;
+  };
+
+  void track_(browse_state& entry,
+              const std::string& instance_name,
+              uint32_t ttl,
+              clock::time_point now) {
+    auto key = instance_name;
+    detail::fold_case(key.data(), key.size(), key.data());
+
+    // A goodbye leaves the record a second to live, and nothing to refresh,
+    // RFC 6762 §10.1. One for an instance we never reported changes nothing.
+    if (ttl == 0) {
+      auto itr = entry.instances.find(key);
+      if (itr != entry.instances.end()) {
+        itr->second = instance{instance_name, now, 1, refresh_count};
+      }
+      return;
+    }
+
+    auto [itr, inserted] = entry.instances.try_emplace(key);
+    itr->second = instance{instance_name, now, ttl, 0};
+    if (inserted && entry.on_added) {
+      entry.on_added(instance_name);
+    }
+  }
+
+  void arm_(size_t id, browse_state& entry) {
+    auto deadline = entry.next_query;
+    for (const auto& [key, known] : entry.instances) {
+      deadline = std::min(
+          deadline, known.refreshes < refresh_count ? known.refresh_at()
+                                                    : known.expires());
+    }
+
+    entry.timer.expires_at(deadline);
+    entry.timer.async_wait(
+        strand_.wrap([this, id](const boost::system::error_code& ec) {
+          if (ec != boost::asio::error::operation_aborted) {
+            on_timer_(id);
+          }
+        }));
+  }
+
+  void on_timer_(size_t id) {
+    auto itr = browses_.find(id);
+    if (itr == browses_.end()) {
+      return;
+    }
+
+    auto& entry = *itr->second;
+    auto now = clock::now();
+    bool query = now >= entry.next_query;
+    if (query) {
+      entry.next_query = now + entry.interval;
+      entry.interval = std::min(entry.interval * 2, max_interval);
+    }
+
+    for (auto known = entry.instances.begin();
+         known != entry.instances.end();) {
+      if (now >= known->second.expires()) {
+        auto name = std::move(known->second.name);
+        known = entry.instances.erase(known);
+        if (entry.on_removed) {
+          entry.on_removed(name);
+        }
+        continue;
+      }
+
+      if (known->second.refreshes < refresh_count &&
+          now >= known->second.refresh_at()) {
+        known->second.refreshes++;
+        query = true;
+      }
+      ++known;
+    }
+
+    if (query) {
+      send_query_(entry);
+    }
+    arm_(id, entry);
+  }
+
+  // A PTR question with every instance we hold with more than half its TTL
+  // left as a known answer, so that only the missing ones get answered
+  void send_query_(const browse_state& entry) {
+    std::vector<cached_record> known_answers;
+    cache_.for_each_record(
+        entry.service_type, message::PTR,
+        [&known_answers](const cached_record& cached) {
+          if (cached.ttl > cached.rr->ttl / 2) {
+            known_answers.push_back(cached);
+          }
+        });
+
+    auto packets = encode_query(
+        {question{entry.service_type, message::PTR, false}}, known_answers);
+    send_handler_(destination_, std::move(packets));
+  }
+
+  static constexpr uint8_t refresh_count = 2;
+  // RFC 6762 §5.2 caps the interval between queries at one hour
+  static constexpr std::chrono::seconds max_interval = std::chrono::hours(1);
+
+  boost::asio::io_context& io_ctx_;
+  boost::asio::io_context::strand& strand_;
+  const record_cache& cache_;
+  const endpoint destination_;
+  send_handler send_handler_;
+  std::mt19937 gen_;
+
+  std::atomic<size_t> next_id_;
+  std::atomic<size_t> browse_count_;
+  std::unordered_map<size_t, std::unique_ptr<browse_state>> browses_;
+};
+
+}  // namespace mmdns::client
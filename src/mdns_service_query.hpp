@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_message_encoder.hpp"
+#include "mdns_record_cache.hpp"
+
+namespace mmdns::client {
+
+using packet = std::shared_ptr<const std::vector<net::net_stream_data>>;
+
+struct question {
+  std::string name;
+  message::mdns_rr_type type;
+  // Ask for a unicast response, RFC 6762 §5.4
+  bool unicast_response;
+};
+
+// Keep queries within an Ethernet frame, RFC 6762 §17
+constexpr size_t max_query_size = 1472;
+
+// Lays |questions| and the |known_answers| we already hold for them out over
+// as many packets as it takes, names compressed. Every packet but the last
+// has the TC bit set, telling responders more known answers follow (RFC 6762
+// §7.2).
+inline std::vector<packet> encode_query(
+    const std::vector<question>& questions,
+    const std::vector<cached_record>& known_answers) {
+  constexpr uint16_t CLASS_IN = 1;
+  constexpr uint16_t UNICAST_RESPONSE_MASK = 0x8000;
+
+  std::vector<packet> packets;
+  codec::compression_table names;
+  size_t next_question = 0;
+  size_t next_answer = 0;
+  do {
+    auto data =
+        std::make_shared<std::vector<net::net_stream_data>>(max_query_size);
+
+    message::mdns_header_t header{};
+    names.clear();
+    codec::mdns_message_encoder encoder{data->data(), data->size(), &names};
+    encoder.encode_header(header);
+
+    for (; next_question < questions.size(); next_question++) {
+      const auto& asked = questions[next_question];
+      uint16_t rr_class =
+          CLASS_IN | (asked.unicast_response ? UNICAST_RESPONSE_MASK : 0);
+      if (!encoder.encode_question(asked.name, asked.type, rr_class)) {
+        break;
+      }
+      header.question_count++;
+    }
+
+    for (; next_answer < known_answers.size(); next_answer++) {
+      // With the TTL it has left in our cache
+      const auto& known = known_answers[next_answer];
+      const auto& wire = known.rr->wire;
+      if (!encoder.encode_rr(wire.data(), wire.size(), known.rr->data_offset,
+                             known.ttl)) {
+        break;
+      }
+      header.answer_count++;
+    }
+
+    if (header.question_count == 0 && header.answer_count == 0) {
+      // Something larger than a packet on its own
+      next_question < questions.size() ? next_question++ : next_answer++;
+      continue;
+    }
+
+    bool more = next_question < questions.size() ||
+                next_answer < known_answers.size();
+    header.set_truncated(more);
+    codec::mdns_message_encoder{data->data(), data->size()}.encode_header(
+        header);
+    data->resize(encoder.get_size());
+    packets.push_back(std::move(data));
+  } while (next_question < questions.size() ||
+           next_answer < known_answers.size());
+
+  return packets;
+}
+
+}  // namespace mmdns::client
@@ -1,18 +1,33 @@
 #pragma once
 
-#include <netdb.h>
 #include <unistd.h>
 #include <algorithm>
+#include <atomic>
 #include <boost/asio.hpp>
-#include <boost/asio/deadline_timer.hpp>
 #include <chrono>
 #include <cinttypes>
+#include <functional>
 #include <map>
+#include <memory>
+#include <optional>
 #include <random>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 
-#include "../tests/test_data.hpp"
-#include "lib/dnslib/src/message.h"
+#include "detail/bloom_filter.hpp"
+#include "detail/clock.hpp"
+#include "detail/mdns_log.hpp"
+#include "detail/metrics.hpp"
+#include "detail/name_kernels.hpp"
+#include "detail/timer_wheel.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_builder.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "net/net_interfaces.hpp"
 
 using namespace std::chrono_literals;
 
@@ -25,255 +40,1180 @@ struct descriptor {
   std::string domain;
   uint16_t port;
   std::vector<std::pair<std::string, std::string>> data;
-  std::shared_ptr<dns::Message> message;
+  // The records of the service as one response in wire format, rebuilt every
+  // time the registry changes them
+  std::shared_ptr<const std::vector<net::net_stream_data>> response;
 };
 
+// A record the registry is authoritative for, or one the cache learnt from
+// the network. Its names and wire format are views into a block of bytes
+// shared by every record copied out of the same message, which each of them
+// keeps alive: a message costs one block rather than a few strings and
+// vectors per record.
+struct record {
+  std::string_view name;
+  message::mdns_name_hash_t name_hash;
+  message::mdns_rr_type type;
+  uint16_t rr_class;
+  bool cache_flush;
+  uint32_t ttl;
+  // Name in the data of PTR and SRV records, additional records follow it
+  std::string_view target;
+  // The whole RR in uncompressed wire format and where its data starts
+  std::span<const net::net_stream_data> wire;
+  uint16_t data_offset;
+  std::shared_ptr<descriptor> service;
+
+  // Copies |rr| out of the packet it was decoded from, names expanded
+  static std::shared_ptr<const record> from_rr(
+      const message::mdns_rr_t& rr,
+      std::shared_ptr<descriptor> service = nullptr) {
+    auto records =
+        copy_([&rr](auto&& visitor) { visitor(rr); }, std::move(service));
+    return records.empty() ? nullptr : std::move(records.front());
+  }
+
+  // Copies the RRs of |sections| that keep(rr) holds for into one block
+  template <typename rr_filter>
+  static std::vector<std::shared_ptr<const record>> from_rrs(
+      std::initializer_list<const std::vector<message::mdns_rr_t>*> sections,
+      rr_filter&& keep,
+      std::shared_ptr<descriptor> service = nullptr) {
+    return copy_(
+        [&sections, &keep](auto&& visitor) {
+          for (const auto* section : sections) {
+            for (const auto& rr : *section) {
+              if (keep(rr)) {
+                visitor(rr);
+              }
+            }
+          }
+        },
+        std::move(service));
+  }
+
+  // Whether |other| has the same name, type, class and data, which makes it
+  // the same record whatever its TTL
+  bool same_record(const record& other) const {
+    if (other.type != type || other.rr_class != rr_class ||
+        other.name_hash != name_hash ||
+        !message::dns_name_equals(other.name, name)) {
+      return false;
+    }
+
+    switch (type) {
+      case message::PTR:
+        return message::dns_name_equals(other.target, target);
+      case message::SRV:
+        // Priority, weight and port, then the target
+        return std::equal(wire.begin() + data_offset,
+                          wire.begin() + data_offset + 6,
+                          other.wire.begin() + other.data_offset) &&
+               message::dns_name_equals(other.target, target);
+      default:
+        return std::equal(wire.begin() + data_offset, wire.end(),
+                          other.wire.begin() + other.data_offset,
+                          other.wire.end());
+    }
+  }
+
+  // Whether |other| is byte for byte the same RR, TTL included
+  bool same_wire(const record& other) const {
+    return std::equal(wire.begin(), wire.end(), other.wire.begin(),
+                      other.wire.end());
+  }
+
+  // Whether |rr| carries this same record: name, type, class and data
+  bool matches(const message::mdns_rr_t& rr) const {
+    if (rr.type != type || rr.rr_class != rr_class || !rr.name.equals(name)) {
+      return false;
+    }
+
+    switch (type) {
+      case message::PTR:
+        return rr.ptr().name.equals(target);
+      case message::SRV: {
+        const auto rr_srv = rr.srv();
+        const auto* data = wire.data() + data_offset;
+        return rr_srv.priority == message::read_u16(data) &&
+               rr_srv.weight == message::read_u16(data + 2) &&
+               rr_srv.port == message::read_u16(data + 4) &&
+               rr_srv.target.equals(target);
+      }
+      default:
+        return rr.data_length == wire.size() - data_offset &&
+               std::equal(wire.begin() + data_offset, wire.end(), rr.data());
+    }
+  }
+
+ private:
+  struct block;
+
+  template <typename rr_walker>
+  static std::vector<std::shared_ptr<const record>> copy_(
+      rr_walker&& walk,
+      std::shared_ptr<descriptor> service);
+
+  // Uncompressed, which is at least what it takes dotted
+  static size_t wire_size_(const message::mdns_name_t& name) {
+    size_t size = 1;
+    name.for_each_label(
+        [&size](std::string_view label) { size += 1 + label.size(); });
+    return size;
+  }
+};
+
+// The records copied out of one message and the bytes they point into
+struct record::block {
+  std::vector<record> records;
+  std::vector<net::net_stream_data> bytes;
+};
+
+// Calls walk(visitor) twice, once to size the block and once to fill it, so
+// that it never moves under the views
+template <typename rr_walker>
+std::vector<std::shared_ptr<const record>> record::copy_(
+    rr_walker&& walk,
+    std::shared_ptr<descriptor> service) {
+  size_t count = 0;
+  size_t size = 0;
+  walk([&count, &size](const message::mdns_rr_t& rr) {
+    const size_t name_size = wire_size_(rr.name);
+    size_t target_size = 0;
+    size_t data_size = rr.data_length;
+    if (rr.type == message::PTR || rr.type == message::SRV) {
+      target_size = wire_size_(rr.target);
+      data_size = (rr.type == message::SRV ? 6 : 0) + target_size;
+    }
+    // The RR, then the owner and target names dotted
+    size += name_size + 10 + data_size + name_size + target_size;
+    count++;
+  });
+
+  auto shared = std::make_shared<block>();
+  shared->records.reserve(count);
+  shared->bytes.resize(size);
+
+  size_t used = 0;
+  auto append_dotted = [&shared, &used](const message::mdns_name_t& name) {
+    auto* start = reinterpret_cast<const char*>(shared->bytes.data() + used);
+    name.for_each_label([&shared, &used, start](std::string_view label) {
+      auto* out = shared->bytes.data() + used;
+      if (reinterpret_cast<const char*>(out) != start) {
+        *out++ = '.';
+        used++;
+      }
+      std::copy(label.begin(), label.end(), out);
+      used += label.size();
+    });
+    return std::string_view(
+        start, reinterpret_cast<const char*>(shared->bytes.data() + used) -
+                   start);
+  };
+
+  walk([&](const message::mdns_rr_t& rr) {
+    auto* wire = shared->bytes.data() + used;
+    codec::mdns_message_encoder encoder{wire, size - used};
+    if (!encoder.encode_rr(rr)) {
+      return;
+    }
+    used += encoder.get_size();
+
+    record built{};
+    built.wire = {wire, encoder.get_size()};
+    built.name = append_dotted(rr.name);
+    built.name_hash = rr.name.hash();
+    built.type = rr.type;
+    built.rr_class = rr.rr_class;
+    built.cache_flush = rr.cache_flush;
+    built.ttl = rr.ttl;
+    if (rr.type == message::PTR || rr.type == message::SRV) {
+      built.target = append_dotted(rr.target);
+    }
+    // Data follows the uncompressed owner name and the fixed RR fields
+    built.data_offset = wire_size_(rr.name) + 10;
+    built.service = service;
+    shared->records.push_back(std::move(built));
+  });
+
+  std::vector<std::shared_ptr<const record>> records;
+  records.reserve(shared->records.size());
+  for (const auto& built : shared->records) {
+    records.emplace_back(shared, &built);
+  }
+  return records;
+}
+
 class registry {
  public:
-  registry(boost::asio::io_context& worker_ctx)
+  using registration_callback =
+      std::function<void(bool, const service::descriptor&)>;
+  using packet = std::shared_ptr<const std::vector<net::net_stream_data>>;
+  using send_handler = std::function<void(packet)>;
+
+  // |addresses| are those to announce the services on, read from the host's
+  // interfaces when not given
+  registry(boost::asio::io_context& worker_ctx,
+           detail::metrics& metrics,
+           std::optional<net::address_provider::address_list> addresses =
+               std::nullopt)
       : data_(),
+        builder_(),
+        metrics_(metrics),
         worker_ctx_(worker_ctx),
         registry_strand_(worker_ctx_),
         socket_(worker_ctx_),
-        timer_(worker_ctx_),
-        service_descriptors_() {
-    socket_.open(dst_endpoint_.protocol());
+        addresses_(worker_ctx_, std::move(addresses)),
+        send_handler_(),
+        goodbye_handler_(),
+        gen_(detail::random_seed()),
+        epoch_(detail::clock::now()),
+        wheel_(),
+        wheel_timer_(worker_ctx_),
+        wheel_armed_(false),
+        armed_tick_(0),
+        due_(),
+        registrations_(),
+        probing_count_(0),
+        services_(),
+        records_(std::make_shared<const published_records>()),
+        staged_(),
+        publications_(),
+        names_stale_(false),
+        registered_(),
+        stopped_(false) {
+    addresses_.start(registry_strand_.wrap(
+        [this](const net::address_provider::address_list&) {
+          on_addresses_changed_();
+        }));
   }
   ~registry() { stop(); }
 
+  // Sends goodbyes for every published service right away, from the calling
+  // thread, and forgets them all. Records the services share go out once.
+  // Only the first call does anything, and it has to be on the registry
+  // strand, see async_stop(), unless nothing else runs the registry anymore.
   void stop() {
-    net::net_stream_data data_[1024];
-    auto expire_rr = [](dns::ResourceRecord* rr) { rr->setTtl(0); };
+    if (stopped_) {
+      return;
+    }
+    stopped_ = true;
 
-    for (const auto& [key, service_descriptor] : service_descriptors_) {
-      auto message = service_descriptor.message;
-      message->setQr(1);
-      auto answers = message->getAnswers();
-      std::for_each(answers.begin(), answers.end(), expire_rr);
+    std::vector<std::shared_ptr<const record>> records;
+    std::unordered_set<const record*> listed;
+    for (auto& [key, entry] : registrations_) {
+      if (entry->current != registration::state::announcing &&
+          entry->current != registration::state::announced) {
+        continue;
+      }
+
+      for (const auto& rr : entry->records) {
+        if (listed.insert(rr.get()).second) {
+          records.push_back(rr);
+        }
+      }
+    }
 
-      auto authorities = message->getAuthorities();
-      std::for_each(authorities.begin(), authorities.end(), expire_rr);
+    for (const auto& data : encode_records_(records, true)) {
+      if (goodbye_handler_) {
+        goodbye_handler_(data);
+      } else {
+        boost::system::error_code ignored;
+        open_socket_();
+        socket_.send_to(boost::asio::buffer(*data), dst_endpoint_, 0,
+                        ignored);
+      }
+      metrics_.add(detail::counter::goodbyes_sent);
+    }
 
-      auto additionals = message->getAdditional();
-      std::for_each(additionals.begin(), additionals.end(), expire_rr);
+    // Their timers leave the wheel with them
+    wheel_timer_.cancel();
+    registrations_.clear();
+    probing_count_ = 0;
+    registered_.clear();
+    due_.clear();
+    publications_.clear();
+    services_.clear();
+    staged_.reset();
+    std::atomic_store(&records_, std::make_shared<const published_records>());
+  }
 
-      mmdns::codec::mdns_message_codec codec{*message};
+  // Runs stop() on the registry strand, then |done|
+  void async_stop(std::function<void()> done) {
+    registry_strand_.post([this, done = std::move(done)]() {
+      stop();
+      done();
+    });
+  }
 
-      size_t data_size = sizeof(data_);
-      auto encoded = codec.encode(data_, data_size);
+  // Probes and announcements go out through |handler|, normally the client's
+  // socket on the mDNS port, so that answers to them make it back to us. Left
+  // unset they go out through the registry's own socket.
+  void set_send_handler(send_handler handler) {
+    send_handler_ = std::move(handler);
+  }
 
-      if (encoded) {
-        socket_.send_to(boost::asio::const_buffer(data_, data_size),
-                        dst_endpoint_);
-      }
-    }
+  // The goodbyes stop() sends go out through |handler|, which has to send
+  // them before it returns. Left unset they go out through the registry's own
+  // socket.
+  void set_goodbye_handler(send_handler handler) {
+    goodbye_handler_ = std::move(handler);
   }
 
+  // Probes for the names of |service| and announces it once they are ours, as
+  // described in RFC 6762 §8. |cb| is called when the records are published,
+  // or when the registration fails because some other host owns the name.
   void register_service(
       service::descriptor&& service,
-      const std::optional<
-          std::function<void(bool, const service::descriptor&)>>& cb = {}) {
+      const std::optional<registration_callback>& cb = {}) {
     worker_ctx_.post(registry_strand_.wrap(
-        [this, service = std::move(service), cb = std::move(cb)]() mutable {
-          auto message = std::make_shared<dns::Message>();
-          service.message = message;
-          build_mdns_message_from_descriptor_(service, message);
-
-          mmdns::codec::mdns_message_codec codec{*message};
-
-          size_t data_size = sizeof(data_);
-          auto status = codec.encode(data_, data_size);
-
-          std::random_device rd;
-          std::mt19937 gen(rd());
-          std::uniform_int_distribution<> distrib(100, 250);
-
-          if (status) {
-            // TODO: Probing
-            for (int retry_count = 0; retry_count < retransmission_count;
-                 retry_count++) {
-              socket_.send_to(boost::asio::const_buffer(data_, data_size),
-                              dst_endpoint_);
-
-              timer_.expires_from_now(
-                  boost::posix_time::milliseconds(distrib(gen)));
-              timer_.wait();
-            }
-
-            diag("Sent registration:\n" + service.message->asString());
-            auto [itr, op_result] = insert_service_(std::move(service));
+        [this, service = std::move(service), cb]() mutable {
+          auto instance_name = instance_name_(service);
+          if (stopped_ || !encode_response_(service) ||
+              services_.count(instance_name) ||
+              registrations_.count(instance_name)) {
             if (cb) {
-              cb.value()(op_result, itr->second);
+              cb.value()(false, service);
             }
+            return;
           }
+
+          auto stored = std::make_shared<descriptor>(std::move(service));
+          auto entry = std::make_unique<registration>();
+          entry->instance_name = instance_name;
+          entry->service = stored;
+          entry->records = build_records_(stored);
+          entry->probe_names = probe_names_(entry->records);
+          entry->cb = cb;
+
+          // The first probe goes out after 0-250 ms so that hosts booting
+          // together don't probe in lockstep
+          std::uniform_int_distribution<> delay(0, 250);
+          auto& scheduled = *registrations_
+                                 .emplace(instance_name, std::move(entry))
+                                 .first->second;
+          probing_count_++;
+          schedule_(scheduled, std::chrono::milliseconds(delay(gen_)));
         }));
   }
 
-  std::optional<std::reference_wrapper<descriptor>> get_service_descriptor(
-      const std::string& service_name) {
-    std::optional<std::reference_wrapper<descriptor>> service_descriptor = {};
-    auto itr = service_descriptors_.find(service_name);
-    if (itr != service_descriptors_.end()) {
-      service_descriptor = itr->second;
+  // Withdraws a service: its records leave the index right away and goodbyes
+  // go out twice, a second apart (RFC 6762 §10.1), for all but those other
+  // services still publish. A service still probing is just dropped, nobody
+  // has heard of it yet.
+  void unregister_service(
+      const std::string& instance_name,
+      const std::optional<std::function<void(bool)>>& cb = {}) {
+    auto key = instance_name;
+    detail::fold_case(key.data(), key.size(), key.data());
+
+    worker_ctx_.post(registry_strand_.wrap([this, key, cb]() {
+      auto itr = registrations_.find(key);
+      bool found = itr != registrations_.end() &&
+                   itr->second->current != registration::state::goodbye;
+      if (found) {
+        auto& entry = *itr->second;
+        if (entry.current == registration::state::probing) {
+          probing_count_--;
+          registrations_.erase(itr);
+        } else {
+          entry.withdrawn = unpublish_(entry);
+          commit_records_();
+          entry.current = registration::state::goodbye;
+          entry.sent = 0;
+          schedule_(entry, 0ms);
+        }
+      }
+
+      if (cb) {
+        cb.value()(found);
+      }
+    }));
+  }
+
+  bool is_probing() const { return probing_count_ > 0; }
+
+  // Feeds a received packet to the registrations still probing: a response
+  // that claims one of their names, or a simultaneous probe that wins the
+  // tie-break, is a conflict (RFC 6762 §8.1, §8.2). |packet| keeps the buffer
+  // the names in |message| point into alive.
+  void on_message(std::shared_ptr<const void> packet,
+                  const message::mdns_message_t& message) {
+    if (!is_probing()) {
+      return;
+    }
+
+    registry_strand_.post([this, packet = std::move(packet), message]() {
+      handle_conflicts_(message);
+    });
+  }
+
+  // Calls visitor(const std::shared_ptr<const record>&) for every record owned
+  // by |name| of the given type, or of every type for ANY. |name| is either a
+  // name in a packet or a dotted string, matched case insensitively.
+  //
+  // Safe to call from any thread: it walks the snapshot of the index that was
+  // current when it started.
+  template <typename name_type, typename record_visitor>
+  void for_each_record(const name_type& name,
+                       message::mdns_rr_type type,
+                       record_visitor&& visitor) const {
+    auto records = std::atomic_load(&records_);
+    auto itr = records->index.find(name_hash_(name));
+    if (itr == records->index.end()) {
+      return;
+    }
+
+    for (const auto& rr : itr->second) {
+      if ((type == message::ANY || rr->type == type) &&
+          name_equals_(name, rr->name)) {
+        visitor(rr);
+      }
     }
+  }
+
+  // Whether we may own records for the name that hashes to |name_hash|.
+  // False for certain, for most names that aren't ours, without touching the
+  // index. Safe to call from any thread.
+  bool may_own(message::mdns_name_hash_t name_hash) const {
+    return std::atomic_load(&records_)->names.may_contain(name_hash);
+  }
+
+  template <typename name_type>
+  std::shared_ptr<const descriptor> get_service_descriptor(
+      const name_type& service_name,
+      message::mdns_rr_type type = message::ANY) const {
+    std::shared_ptr<const descriptor> service_descriptor;
+    for_each_record(service_name, type,
+                    [&](const std::shared_ptr<const record>& rr) {
+                      if (!service_descriptor) {
+                        service_descriptor = rr->service;
+                      }
+                    });
     return service_descriptor;
   }
 
  private:
-  std::pair<std::map<std::string, descriptor>::const_iterator, bool>
-  insert_service_(descriptor&& service) {
-    std::pair<decltype(service_descriptors_)::const_iterator, bool> result;
-    auto msg = service.message;
-    for (auto answer : service.message->getAnswers()) {
-      result = service_descriptors_.try_emplace(answer->getName(), service);
-    }
-
-    for (auto authority : service.message->getAuthorities()) {
-      result = service_descriptors_.try_emplace(authority->getName(), service);
-    }
-
-    for (auto additional : service.message->getAdditional()) {
-      result = service_descriptors_.try_emplace(additional->getName(), service);
-    }
-
-    return result;
-  }
-
-  bool build_mdns_message_from_descriptor_(
-      const descriptor& descriptor,
-      std::shared_ptr<dns::Message> message) {
-    message->setQr(1);
-    message->setAA(1);
-
-    auto txt_rr = new dns::ResourceRecord;
-    txt_rr->setName(descriptor.name + "." + descriptor.type + "." +
-                    descriptor.domain);
-    txt_rr->setType(dns::RDATA_TXT);
-    txt_rr->setClass(dns::CLASS_IN_FLUSH);
-    txt_rr->setTtl(4500);
-
-    auto txt_data = new dns::RDataTXT;
-    for (auto data : descriptor.data) {
-      txt_data->addTxt(data.first + "=" + data.second);
-    }
-    txt_rr->setRData(txt_data);
-    message->addAnswer(txt_rr);
-
-    auto service_ptr_rr = new dns::ResourceRecord;
-    service_ptr_rr->setName("_services.dns-sd._upd.local");
-    service_ptr_rr->setType(dns::RDATA_PTR);
-    service_ptr_rr->setClass(dns::CLASS_IN);
-    service_ptr_rr->setTtl(4500);
-
-    auto service_ptr_data = new dns::RDataPTR;
-    service_ptr_data->setName(descriptor.type + "." + descriptor.domain);
-    service_ptr_rr->setRData(service_ptr_data);
-    message->addAnswer(service_ptr_rr);
-
-    // At least three records will be addded: 2 PTR and 1 SRV -- TXT are
-    // optional
-    auto ptr_rr = new dns::ResourceRecord;
-    ptr_rr->setName(descriptor.type + "." + descriptor.domain);
-    ptr_rr->setType(dns::RDATA_PTR);
-    ptr_rr->setClass(dns::CLASS_IN);
-    ptr_rr->setTtl(4500);
-
-    auto ptr_data = new dns::RDataPTR;
-    ptr_data->setName(descriptor.name + "." + descriptor.type + "." +
-                      descriptor.domain);
-
-    ptr_rr->setRData(ptr_data);
-    message->addAnswer(ptr_rr);
-
-    auto srv_rr = new dns::ResourceRecord;
-    srv_rr->setName(descriptor.name + "." + descriptor.type + "." +
-                    descriptor.domain);
-    srv_rr->setType(dns::RDATA_SRV);
-    srv_rr->setClass(dns::CLASS_IN_FLUSH);
-    srv_rr->setTtl(120);
-
-    auto srv_data = new dns::RDataSRV;
-    srv_data->setPort(descriptor.port);
-    srv_data->setTarget(descriptor.host_name);
-
-    srv_rr->setRData(srv_data);
-    message->addAnswer(srv_rr);
-
-    auto a_rr = new dns::ResourceRecord;
-    a_rr->setName(descriptor.host_name);
-    a_rr->setType(dns::RDATA_A);
-    a_rr->setClass(dns::CLASS_IN_FLUSH);
-    a_rr->setTtl(120);
-
-    auto a_data = new dns::RDataA;
-    struct addrinfo hints, *result;
-    memset(&hints, 0, sizeof(decltype(hints)));
-    hints.ai_flags = AI_CANONNAME;
-    hints.ai_family = AF_INET;
-    auto n =
-        getaddrinfo(descriptor.host_name.c_str(), nullptr, &hints, &result);
-
-    if (n != 0) {
-      diag("Failed to get host ipv4 address");
+  struct published_records;
+
+  // Lays the records of |service| out as one response: TXT, the PTR that
+  // lists its type (RFC 6763 §9), the PTR to the instance and SRV as answers,
+  // and one A or AAAA record per interface address as additional records
+  bool encode_response_(descriptor& service) {
+    using section = codec::mdns_message_builder::section;
+
+    builder_.reset();
+    service.response.reset();
+    auto instance =
+        builder_.intern({service.name, service.type, service.domain});
+    auto type = builder_.intern({service.type, service.domain});
+    auto service_types =
+        builder_.intern({"_services._dns-sd._udp", service.domain});
+    auto host = builder_.intern({service.host_name});
+    if (!instance || !type || !service_types || !host) {
+      return false;
+    }
+
+    if (!builder_.add_txt(section::answer, *instance, shared_ttl, true,
+                          service.data) ||
+        !builder_.add_ptr(section::answer, *service_types, shared_ttl, false,
+                          *type) ||
+        !builder_.add_ptr(section::answer, *type, shared_ttl, false,
+                          *instance) ||
+        !builder_.add_srv(section::answer, *instance, host_ttl, true, 0, 0,
+                          service.port, *host)) {
       return false;
     }
 
-    char ip_buffer[128];
-    inet_ntop(
-        hints.ai_family,
-        &(reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr),
-        ip_buffer, sizeof(ip_buffer));
+    // One A or AAAA record per interface address, as the kernel reports them
+    auto addresses = addresses_.addresses();
+    if (addresses.empty()) {
+      MMDNS_LOG(warning, "No interface addresses for ", service.host_name);
+    }
+
+    for (const auto& address : addresses) {
+      bool added;
+      if (address.is_v4()) {
+        auto bytes = address.to_v4().to_bytes();
+        added = builder_.add_address(section::additional, *host, host_ttl,
+                                     true, bytes.data(), bytes.size());
+      } else {
+        auto bytes = address.to_v6().to_bytes();
+        added = builder_.add_address(section::additional, *host, host_ttl,
+                                     true, bytes.data(), bytes.size());
+      }
+
+      if (!added) {
+        return false;
+      }
+    }
+
+    service.response = builder_.finish();
+    return true;
+  }
+
+  struct name_hash_identity {
+    size_t operator()(message::mdns_name_hash_t hash) const { return hash; }
+  };
 
-    a_data->setAddress(ip_buffer);
-    a_rr->setRData(a_data);
-    message->addAdditional(a_rr);
-    freeaddrinfo(result);
-    result = nullptr;
+  static message::mdns_name_hash_t name_hash_(std::string_view name) {
+    return message::hash_dns_name(name);
+  }
 
-    auto aaaa_rr = new dns::ResourceRecord;
-    aaaa_rr->setName(descriptor.host_name);
-    aaaa_rr->setType(dns::RDATA_AAAA);
-    aaaa_rr->setClass(dns::CLASS_IN_FLUSH);
-    aaaa_rr->setTtl(120);
+  static message::mdns_name_hash_t name_hash_(
+      const message::mdns_name_t& name) {
+    return name.hash();
+  }
 
-    auto aaaa_data = new dns::RDataAAAA;
-    hints.ai_family = AF_INET6;
-    n = getaddrinfo(descriptor.host_name.c_str(), nullptr, &hints, &result);
+  static bool name_equals_(std::string_view name, std::string_view owner) {
+    return message::dns_name_equals(name, owner);
+  }
 
-    if (n != 0) {
-      diag("Failed to get host ipv4 address");
-      return false;
+  static bool name_equals_(const message::mdns_name_t& name,
+                           std::string_view owner) {
+    return name.equals(owner);
+  }
+
+  // Something due on the registry's timer wheel
+  struct timer_task : detail::timer_node {
+    enum class kind : uint8_t { registration, refresh };
+
+    explicit timer_task(kind what) : what(what) {}
+
+    const kind what;
+  };
+
+  struct registration;
+
+  // Where a record is in its refresh cycle: it goes out again at 80%, 85%, 90%
+  // and 95% of its TTL, the extra sends covering for lost packets the same way
+  // queriers retry (RFC 6762 §5.2), and the cycle starts over from the last
+  // one.
+  struct refresh_task : timer_task {
+    refresh_task() : timer_task(kind::refresh) {}
+
+    std::shared_ptr<const record> rr;
+    uint64_t cycle_start = 0;
+    uint8_t stage = 0;
+  };
+
+  // A record in the index, and how many registrations publish it. Services
+  // on one host share its address records, and services of one type the PTR
+  // that lists the type, so that these are indexed, refreshed and withdrawn
+  // once however many services there are.
+  struct publication {
+    size_t publishers = 0;
+    refresh_task refresh;
+  };
+
+  // A registered service, from its first probe to its last goodbye
+  struct registration : timer_task {
+    enum class state { probing, announcing, announced, goodbye };
+
+    registration() : timer_task(kind::registration) {}
+
+    std::string instance_name;
+    std::shared_ptr<descriptor> service;
+    // Once published, the records other registrations published first are
+    // the ones in the index
+    std::vector<std::shared_ptr<const record>> records;
+    // Names of the unique records, the ones we have to probe for
+    std::vector<std::string> probe_names;
+    std::optional<registration_callback> cb;
+
+    state current = state::probing;
+    size_t sent = 0;
+    // What goodbyes are sent for, the records nobody else publishes
+    std::vector<std::shared_ptr<const record>> withdrawn;
+  };
+
+  // The names of the unique records
+  static std::vector<std::string> probe_names_(
+      const std::vector<std::shared_ptr<const record>>& records) {
+    std::vector<std::string> names;
+    for (const auto& rr : records) {
+      bool listed = std::any_of(names.begin(), names.end(),
+                                [&rr](const std::string& name) {
+                                  return message::dns_name_equals(name,
+                                                                  rr->name);
+                                });
+      if (rr->cache_flush && !listed) {
+        names.emplace_back(rr->name);
+      }
     }
+    return names;
+  }
 
-    inet_ntop(
-        hints.ai_family,
-        &(reinterpret_cast<struct sockaddr_in6*>(result->ai_addr)->sin6_addr),
-        ip_buffer, sizeof(ip_buffer));
-    aaaa_data->setAddress(reinterpret_cast<const unsigned char*>(ip_buffer));
-    aaaa_rr->setRData(aaaa_data);
-    message->addAdditional(aaaa_rr);
+  // New addresses mean new A and AAAA records: services still probing carry
+  // them from now on, published ones are republished and announced again
+  // (RFC 6762 §8.4)
+  void on_addresses_changed_() {
+    for (auto& [key, entry] : registrations_) {
+      if (entry->current == registration::state::goodbye) {
+        continue;
+      }
 
-    freeaddrinfo(result);
-    return true;
+      auto updated = std::make_shared<descriptor>(*entry->service);
+      if (!encode_response_(*updated)) {
+        continue;
+      }
+
+      bool published = entry->current != registration::state::probing;
+      if (published) {
+        unpublish_(*entry);
+      }
+
+      entry->service = std::move(updated);
+      entry->records = build_records_(entry->service);
+      entry->probe_names = probe_names_(entry->records);
+
+      if (published) {
+        MMDNS_LOG(info, "Addresses changed, announcing ", entry->instance_name);
+        publish_(*entry);
+        entry->current = registration::state::announcing;
+        entry->sent = 0;
+        schedule_(*entry, 0ms);
+      }
+    }
+    commit_records_();
+  }
+
+  static std::string instance_name_(const descriptor& service) {
+    auto instance_name =
+        service.name + "." + service.type + "." + service.domain;
+    detail::fold_case(instance_name.data(), instance_name.size(),
+                      instance_name.data());
+    return instance_name;
+  }
+
+  void send_(packet data) {
+    if (send_handler_) {
+      send_handler_(std::move(data));
+    } else {
+      open_socket_();
+      socket_.async_send_to(
+          boost::asio::buffer(*data), dst_endpoint_,
+          [data](const boost::system::error_code&, std::size_t) {});
+    }
+  }
+
+  // Opened on first use, a registry that sends through handlers has none
+  void open_socket_() {
+    if (!socket_.is_open()) {
+      boost::system::error_code ignored;
+      socket_.open(dst_endpoint_.protocol(), ignored);
+    }
+  }
+
+  uint64_t now_tick_() const {
+    return (detail::clock::now() - epoch_) / wheel_tick;
+  }
+
+  void schedule_(timer_task& task, std::chrono::milliseconds delay) {
+    schedule_at_(task, now_tick_() + (delay + wheel_tick - 1ms) / wheel_tick);
+  }
+
+  void schedule_at_(timer_task& task, uint64_t tick) {
+    wheel_.schedule(task, tick);
+    arm_();
+  }
+
+  // One asio timer for the whole wheel, set for the next tick anything may be
+  // due at
+  void arm_() {
+    uint64_t tick;
+    if (!wheel_.next_expiry(tick) || (wheel_armed_ && tick >= armed_tick_)) {
+      return;
+    }
+
+    wheel_armed_ = true;
+    armed_tick_ = tick;
+    wheel_timer_.expires_at(epoch_ + tick * wheel_tick);
+    wheel_timer_.async_wait(
+        registry_strand_.wrap([this](const boost::system::error_code& ec) {
+          if (ec != boost::asio::error::operation_aborted) {
+            wheel_armed_ = false;
+            on_wheel_timer_();
+          }
+        }));
+  }
+
+  void on_wheel_timer_() {
+    wheel_.advance(now_tick_(), [this](detail::timer_node& node) {
+      auto& task = static_cast<timer_task&>(node);
+      if (task.what == timer_task::kind::refresh) {
+        on_refresh_timer_(static_cast<refresh_task&>(task));
+      } else {
+        on_registration_timer_(static_cast<registration&>(task));
+      }
+    });
+
+    // Services whose probing ended on this tick are published with a single
+    // copy of the index, and only reported once they are
+    commit_records_();
+    for (auto& [cb, service] : registered_) {
+      cb(true, *service);
+    }
+    registered_.clear();
+
+    // Records due on the same tick go out together
+    if (!due_.empty()) {
+      send_records_(due_, false);
+      due_.clear();
+    }
+
+    arm_();
+  }
+
+  void on_refresh_timer_(refresh_task& task) {
+    due_.push_back(task.rr);
+
+    if (++task.stage == refresh_stages) {
+      task.cycle_start = wheel_.now();
+      task.stage = 0;
+    }
+    schedule_refresh_(task);
+  }
+
+  void schedule_refresh_(refresh_task& task) {
+    uint64_t ttl = std::chrono::seconds(task.rr->ttl) / wheel_tick;
+    wheel_.schedule(task,
+                    task.cycle_start + ttl * (80 + 5 * task.stage) / 100);
+  }
+
+  // Three probes 250 ms apart, then announcements one second apart with the
+  // interval doubling every time. Goodbyes go out twice, a second apart.
+  void on_registration_timer_(registration& entry) {
+    if (entry.current == registration::state::goodbye) {
+      metrics_.add(detail::counter::goodbyes_sent,
+                   send_records_(entry.withdrawn, true));
+      if (++entry.sent < goodbye_count) {
+        schedule_(entry, 1000ms);
+      } else {
+        auto key = entry.instance_name;
+        registrations_.erase(key);
+      }
+      return;
+    }
+
+    if (entry.current == registration::state::probing) {
+      if (entry.sent < probe_count) {
+        send_(make_probe_(entry));
+        metrics_.add(detail::counter::probes_sent);
+        entry.sent++;
+        schedule_(entry, 250ms);
+        return;
+      }
+
+      publish_(entry);
+      probing_count_--;
+      entry.current = registration::state::announcing;
+      entry.sent = 0;
+      if (entry.cb) {
+        registered_.emplace_back(entry.cb.value(), entry.service);
+      }
+    }
+
+    MMDNS_LOG(info, "Announcing ", entry.instance_name);
+    send_(entry.service->response);
+    metrics_.add(detail::counter::announcements_sent);
+    entry.sent++;
+    if (entry.sent < announcement_count) {
+      schedule_(entry, std::chrono::milliseconds(1000 << (entry.sent - 1)));
+    } else {
+      entry.current = registration::state::announced;
+    }
+  }
+
+  // Returns how many packets it took
+  size_t send_records_(
+      const std::vector<std::shared_ptr<const record>>& records,
+      bool goodbye) {
+    auto packets = encode_records_(records, goodbye);
+    for (auto& data : packets) {
+      send_(std::move(data));
+    }
+    return packets.size();
+  }
+
+  // Packs |records| into as few responses as it takes, names compressed, with
+  // a TTL of zero for goodbyes
+  std::vector<packet> encode_records_(
+      const std::vector<std::shared_ptr<const record>>& records,
+      bool goodbye) const {
+    std::vector<packet> packets;
+    codec::compression_table names;
+    size_t next = 0;
+    while (next < records.size()) {
+      auto data =
+          std::make_shared<std::vector<net::net_stream_data>>(max_packet_size);
+
+      message::mdns_header_t header{};
+      header.flags = message::mdns_header_t::QUERY_MASK |
+                     message::mdns_header_t::AUTHORATIVE_MASK;
+
+      names.clear();
+      codec::mdns_message_encoder encoder{data->data(), data->size(), &names};
+      encoder.encode_header(header);
+
+      for (; next < records.size(); next++) {
+        const auto& rr = *records[next];
+        if (!encoder.encode_rr(rr.wire.data(), rr.wire.size(), rr.data_offset,
+                               goodbye ? 0 : rr.ttl)) {
+          break;
+        }
+        header.answer_count++;
+      }
+
+      if (header.answer_count == 0) {
+        // Larger than a packet on its own
+        next++;
+        continue;
+      }
+
+      codec::mdns_message_encoder{data->data(), data->size()}.encode_header(
+          header);
+      data->resize(encoder.get_size());
+      packets.push_back(std::move(data));
+    }
+    return packets;
+  }
+
+  // A query for every name we probe for, type ANY with the unicast response
+  // bit set, and the records we intend to claim them with in the authority
+  // section
+  packet make_probe_(const registration& entry) {
+    message::mdns_header_t header{};
+    codec::compression_table names;
+    codec::mdns_message_encoder encoder{data_, sizeof(data_), &names};
+    encoder.encode_header(header);
+
+    for (const auto& name : entry.probe_names) {
+      if (encoder.encode_question(name, message::ANY, 0x8000 | 1)) {
+        header.question_count++;
+      }
+    }
+
+    for (const auto& rr : entry.records) {
+      if (rr->cache_flush &&
+          encoder.encode_rr(rr->wire.data(), rr->wire.size(), rr->data_offset,
+                            rr->ttl)) {
+        header.authority_rr_count++;
+      }
+    }
+
+    codec::mdns_message_encoder{data_, sizeof(data_)}.encode_header(header);
+    return std::make_shared<std::vector<net::net_stream_data>>(
+        data_, data_ + encoder.get_size());
+  }
+
+  void handle_conflicts_(const message::mdns_message_t& message) {
+    for (auto itr = registrations_.begin(); itr != registrations_.end();) {
+      auto& entry = *itr->second;
+      if (entry.current != registration::state::probing) {
+        ++itr;
+        continue;
+      }
+
+      if (!message.header.is_query() && is_claimed_(entry, message)) {
+        MMDNS_LOG(warning, "Name conflict for ", entry.instance_name);
+        metrics_.add(detail::counter::name_conflicts);
+        probing_count_--;
+        if (entry.cb) {
+          entry.cb.value()(false, *entry.service);
+        }
+        itr = registrations_.erase(itr);
+        continue;
+      }
+
+      if (message.header.is_query() && loses_tiebreak_(entry, message)) {
+        // RFC 6762 §8.2: wait a second and start probing over
+        MMDNS_LOG(info, "Lost probe tie-break for ", entry.instance_name);
+        entry.sent = 0;
+        schedule_(entry, 1000ms);
+      }
+
+      ++itr;
+    }
+  }
+
+  bool is_probed_name_(const registration& entry,
+                       const message::mdns_name_t& name) const {
+    return std::any_of(
+        entry.probe_names.begin(), entry.probe_names.end(),
+        [&name](const std::string& probed) { return name.equals(probed); });
+  }
+
+  // A response carrying a record for one of our names that isn't one of ours
+  bool is_claimed_(const registration& entry,
+                   const message::mdns_message_t& response) const {
+    auto claims = [&](const message::mdns_rr_t& rr) {
+      return is_probed_name_(entry, rr.name) &&
+             std::none_of(entry.records.begin(), entry.records.end(),
+                          [&rr](const std::shared_ptr<const record>& ours) {
+                            return ours->matches(rr);
+                          });
+    };
+    return std::any_of(response.answers.begin(), response.answers.end(),
+                       claims) ||
+           std::any_of(response.additionals.begin(),
+                       response.additionals.end(), claims);
+  }
+
+  // RFC 6762 §8.2.1: for every name both probes claim, the records of each
+  // side are sorted and compared pairwise by class, type and data. The side
+  // whose records come first lexicographically loses.
+  bool loses_tiebreak_(const registration& entry,
+                       const message::mdns_message_t& probe) {
+    auto before = [](const record& lhs, const record& rhs) {
+      if (lhs.rr_class != rhs.rr_class) {
+        return lhs.rr_class < rhs.rr_class;
+      }
+      if (lhs.type != rhs.type) {
+        return lhs.type < rhs.type;
+      }
+      return std::lexicographical_compare(
+          lhs.wire.begin() + lhs.data_offset, lhs.wire.end(),
+          rhs.wire.begin() + rhs.data_offset, rhs.wire.end());
+    };
+    auto sort = [&before](std::vector<std::shared_ptr<const record>>& rrs) {
+      std::sort(rrs.begin(), rrs.end(),
+                [&before](const auto& lhs, const auto& rhs) {
+                  return before(*lhs, *rhs);
+                });
+    };
+
+    for (const auto& name : entry.probe_names) {
+      std::vector<std::shared_ptr<const record>> theirs;
+      for (const auto& rr : probe.authorities) {
+        if (rr.name.equals(name)) {
+          if (auto claimed = make_record_(rr, nullptr)) {
+            theirs.push_back(std::move(claimed));
+          }
+        }
+      }
+
+      if (theirs.empty()) {
+        continue;
+      }
+
+      std::vector<std::shared_ptr<const record>> ours;
+      std::copy_if(entry.records.begin(), entry.records.end(),
+                   std::back_inserter(ours), [&name](const auto& rr) {
+                     return rr->cache_flush &&
+                            message::dns_name_equals(rr->name, name);
+                   });
+      sort(ours);
+      sort(theirs);
+
+      for (size_t idx = 0; idx < std::min(ours.size(), theirs.size()); idx++) {
+        if (before(*ours[idx], *theirs[idx])) {
+          return true;
+        }
+        if (before(*theirs[idx], *ours[idx])) {
+          return false;
+        }
+      }
+
+      if (ours.size() != theirs.size()) {
+        return ours.size() < theirs.size();
+      }
+    }
+
+    return false;
+  }
+
+  // The records of |service| as they go out on the wire
+  std::vector<std::shared_ptr<const record>> build_records_(
+      const std::shared_ptr<descriptor>& service) {
+    auto response = service->response;
+    net::net_stream stream(response->data(), response->size());
+    message::mdns_message_t message;
+    codec::mdns_message_decoder decoder{message};
+    if (!decoder.decode(stream)) {
+      return {};
+    }
+
+    return record::from_rrs(
+        {&message.answers, &message.authorities, &message.additionals},
+        [](const message::mdns_rr_t&) { return true; }, service);
+  }
+
+  // Indexes the records of |entry|, or counts it as one more publisher of
+  // those already in the index
+  void publish_(registration& entry) {
+    services_.emplace(entry.instance_name, entry.service);
+
+    auto& records = staged_records_();
+    for (auto& rr : entry.records) {
+      auto& owned = records.index[rr->name_hash];
+      auto same = std::find_if(
+          owned.begin(), owned.end(),
+          [&rr](const std::shared_ptr<const record>& other) {
+            return other->same_record(*rr);
+          });
+      if (same != owned.end()) {
+        rr = *same;
+        publications_.at(rr.get())->publishers++;
+        continue;
+      }
+
+      owned.push_back(rr);
+      records.names.insert(rr->name_hash);
+
+      auto& published = publications_[rr.get()];
+      published = std::make_unique<publication>();
+      published->publishers = 1;
+      published->refresh.rr = rr;
+      published->refresh.cycle_start = wheel_.now();
+      if (rr->ttl > 0) {
+        schedule_refresh_(published->refresh);
+      }
+    }
+  }
+
+  // Returns the records that left the index, those |entry| was the last to
+  // publish
+  std::vector<std::shared_ptr<const record>> unpublish_(
+      registration& entry) {
+    services_.erase(entry.instance_name);
+
+    std::vector<std::shared_ptr<const record>> withdrawn;
+    auto& records = staged_records_();
+    for (const auto& rr : entry.records) {
+      auto published = publications_.find(rr.get());
+      if (published == publications_.end() ||
+          --published->second->publishers != 0) {
+        continue;
+      }
+
+      // Takes its refresh off the wheel
+      publications_.erase(published);
+      withdrawn.push_back(rr);
+
+      auto itr = records.index.find(rr->name_hash);
+      if (itr == records.index.end()) {
+        continue;
+      }
+
+      auto& owned = itr->second;
+      owned.erase(std::remove(owned.begin(), owned.end(), rr), owned.end());
+      if (owned.empty()) {
+        records.index.erase(itr);
+      }
+    }
+    names_stale_ = true;
+    return withdrawn;
+  }
+
+  // The copy of the index that publish_() and unpublish_() change, made on
+  // the first change after a commit. Readers keep using the current index
+  // until commit_records_() swaps the copy in.
+  published_records& staged_records_() {
+    if (!staged_) {
+      staged_ =
+          std::make_shared<published_records>(*std::atomic_load(&records_));
+    }
+    return *staged_;
+  }
+
+  void commit_records_() {
+    if (!staged_) {
+      return;
+    }
+
+    // Nothing comes out of a Bloom filter, it is filled again from scratch
+    if (names_stale_) {
+      staged_->names.clear();
+      for (const auto& [hash, owned] : staged_->index) {
+        staged_->names.insert(hash);
+      }
+      names_stale_ = false;
+    }
+
+    std::atomic_store(&records_, std::shared_ptr<const published_records>(
+                                     std::move(staged_)));
+  }
+
+  std::shared_ptr<const record> make_record_(
+      const message::mdns_rr_t& rr,
+      const std::shared_ptr<descriptor>& service) {
+    return record::from_rr(rr, service);
   }
 
  private:
   net::net_stream_data data_[1024];
+  codec::mdns_message_builder builder_;
+  detail::metrics& metrics_;
   boost::asio::io_service& worker_ctx_;
   boost::asio::io_service::strand registry_strand_;
 
+  // Only used when no send handler is set
   boost::asio::ip::udp::socket socket_;
-  boost::asio::deadline_timer timer_;
-  std::map<size_t, size_t> retransmit_count_;
+  net::address_provider addresses_;
+  send_handler send_handler_;
+  send_handler goodbye_handler_;
+  std::mt19937 gen_;
+
+  // Probes, announcements, goodbyes and record refreshes all run off this one
+  // wheel and the one asio timer that drives it
+  static constexpr auto wheel_tick = 10ms;
+  const detail::clock::time_point epoch_;
+  detail::timer_wheel wheel_;
+  detail::timer wheel_timer_;
+  bool wheel_armed_;
+  uint64_t armed_tick_;
+  std::vector<std::shared_ptr<const record>> due_;
+
+  // Every registration from its first probe to its last goodbye, by
+  // lowercased instance name
+  std::unordered_map<std::string, std::unique_ptr<registration>>
+      registrations_;
+  std::atomic<size_t> probing_count_;
 
   const boost::asio::ip::address dns_srv_address_ =
       boost::asio::ip::address::from_string("224.0.0.251");
   const size_t dns_port = 5353;
   const boost::asio::ip::udp::endpoint dst_endpoint_ =
       boost::asio::ip::udp::endpoint(dns_srv_address_, dns_port);
-  const size_t retransmission_count = 2;
+  const size_t probe_count = 3;
+  const size_t announcement_count = 2;
+  const size_t goodbye_count = 2;
+  const uint8_t refresh_stages = 4;
+  // RFC 6762 §10: records with the host name in them live two minutes, the
+  // others 75 minutes
+  static constexpr uint32_t host_ttl = 120;
+  static constexpr uint32_t shared_ttl = 4500;
+  // Same limit the scheduler keeps responses under
+  const size_t max_packet_size = 1472;
+
+  using record_index =
+      std::unordered_map<message::mdns_name_hash_t,
+                         std::vector<std::shared_ptr<const record>>,
+                         name_hash_identity>;
+
+  // The published records by the hash of their owner name, and a filter of
+  // those hashes that rules most other names out in a few bit tests
+  struct published_records {
+    record_index index;
+    detail::bloom_filter<4096> names;
+  };
 
-  std::map<std::string, descriptor> service_descriptors_;
+  // Services by lowercased instance name, only touched on the registry strand,
+  // and the records they own. The records are copied on write and swapped
+  // atomically, so the receive path can read them from any thread.
+  std::unordered_map<std::string, std::shared_ptr<descriptor>> services_;
+  std::shared_ptr<const published_records> records_;
+  std::shared_ptr<published_records> staged_;
+  // Every record in the index, by address, with its refresh on the wheel
+  std::unordered_map<const record*, std::unique_ptr<publication>>
+      publications_;
+  bool names_stale_;
+  // Callbacks of the registrations published on the current tick
+  std::vector<
+      std::pair<registration_callback, std::shared_ptr<const descriptor>>>
+      registered_;
+  bool stopped_;
 };
 
 }  // namespace mmdns::service
\ No newline at end of file
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "detail/name_kernels.hpp"
+#include "mdns_message.hpp"
+#include "mdns_record_cache.hpp"
+#include "mdns_service_query.hpp"
+
+namespace mmdns::client {
+
+// Where an instance runs, from its SRV and TXT records
+struct service_info {
+  std::string instance_name;
+  std::string host_name;
+  uint16_t priority;
+  uint16_t weight;
+  uint16_t port;
+  std::vector<std::pair<std::string, std::string>> data;
+};
+
+// The addresses of a host, from its A and AAAA records
+struct host_info {
+  std::string host_name;
+  std::vector<boost::asio::ip::address> addresses;
+};
+
+// One-shot lookups answered from the cache when it holds what they ask for,
+// both the SRV and the TXT of a service, and from the network otherwise.
+// Lookups of the same name share a single query and whatever it brings back.
+// The first query asks for a unicast response (RFC 6762 §5.4); while nothing
+// comes back it is repeated as a plain multicast one after one second and
+// again two seconds later, and the lookup fails three seconds after that.
+//
+// Handlers are called on |strand|.
+class resolver {
+ public:
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using send_handler =
+      std::function<void(const endpoint&, std::vector<packet>&&)>;
+  using service_handler = std::function<void(bool, const service_info&)>;
+  using host_handler = std::function<void(bool, const host_info&)>;
+  using clock = detail::clock;
+
+  resolver(boost::asio::io_context& io_ctx,
+           boost::asio::io_context::strand& strand,
+           const record_cache& cache,
+           const endpoint& destination,
+           send_handler handler)
+      : io_ctx_(io_ctx),
+        strand_(strand),
+        cache_(cache),
+        destination_(destination),
+        send_handler_(std::move(handler)),
+        pending_count_(0),
+        pending_() {}
+
+  ~resolver() = default;
+
+  void resolve(const std::string& instance_name, service_handler handler) {
+    lookup_(kind::service, instance_name,
+            [handler = std::move(handler)](bool found, const result& answer) {
+              handler(found, std::get<service_info>(answer));
+            });
+  }
+
+  void resolve_host(const std::string& host_name, host_handler handler) {
+    lookup_(kind::host, host_name,
+            [handler = std::move(handler)](bool found, const result& answer) {
+              handler(found, std::get<host_info>(answer));
+            });
+  }
+
+  std::future<std::optional<service_info>> resolve(
+      const std::string& instance_name) {
+    auto promise =
+        std::make_shared<std::promise<std::optional<service_info>>>();
+    auto future = promise->get_future();
+    resolve(instance_name, [promise](bool found, const service_info& info) {
+      promise->set_value(found ? std::make_optional(info) : std::nullopt);
+    });
+    return future;
+  }
+
+  std::future<std::optional<host_info>> resolve_host(
+      const std::string& host_name) {
+    auto promise = std::make_shared<std::promise<std::optional<host_info>>>();
+    auto future = promise->get_future();
+    resolve_host(host_name, [promise](bool found, const host_info& info) {
+      promise->set_value(found ? std::make_optional(info) : std::nullopt);
+    });
+    return future;
+  }
+
+  bool is_resolving() const { return pending_count_ > 0; }
+
+  // Completes the lookups |response| has records for. Has to come after the
+  // response went into the cache. |packet| keeps the buffer the names in
+  // |response| point into alive.
+  void on_response(std::shared_ptr<const void> packet,
+                   const message::mdns_message_t& response) {
+    if (!is_resolving()) {
+      return;
+    }
+
+    strand_.post([this, packet = std::move(packet), response]() {
+      for (auto itr = pending_.begin(); itr != pending_.end();) {
+        const auto& [key, lookup] = *itr;
+        auto answers = [&lookup](const message::mdns_rr_t& rr) {
+          return rr.name.equals(lookup->name);
+        };
+
+        result answer;
+        if ((std::any_of(response.answers.begin(), response.answers.end(),
+                         answers) ||
+             std::any_of(response.additionals.begin(),
+                         response.additionals.end(), answers)) &&
+            from_cache_(key.first, lookup->name, answer)) {
+          auto done = std::move(itr->second);
+          itr = pending_.erase(itr);
+          pending_count_--;
+          complete_(*done, true, answer);
+        } else {
+          ++itr;
+        }
+      }
+    });
+  }
+
+ private:
+  enum class kind { service, host };
+
+  using result = std::variant<service_info, host_info>;
+  using result_handler = std::function<void(bool, const result&)>;
+
+  struct pending_lookup {
+    pending_lookup(boost::asio::io_context& io_ctx) : timer(io_ctx) {}
+
+    std::string name;
+    std::vector<result_handler> waiters;
+    size_t sent = 0;
+    detail::timer timer;
+  };
+
+  using lookup_key = std::pair<kind, std::string>;
+
+  struct lookup_key_hash {
+    size_t operator()(const lookup_key& key) const {
+      return std::hash<std::string>{}(key.second) ^
+             static_cast<size_t>(key.first);
+    }
+  };
+
+  void lookup_(kind what, const std::string& name, result_handler handler) {
+    auto key = name;
+    detail::fold_case(key.data(), key.size(), key.data());
+
+    strand_.post([this, what, name, key = std::move(key),
+                  handler = std::move(handler)]() mutable {
+      auto itr = pending_.find({what, key});
+      if (itr != pending_.end()) {
+        itr->second->waiters.push_back(std::move(handler));
+        return;
+      }
+
+      result answer;
+      if (from_cache_(what, name, answer)) {
+        handler(true, answer);
+        return;
+      }
+
+      auto lookup = std::make_unique<pending_lookup>(io_ctx_);
+      lookup->name = name;
+      lookup->waiters.push_back(std::move(handler));
+      auto& started =
+          *pending_.emplace(lookup_key{what, key}, std::move(lookup))
+               .first->second;
+      pending_count_++;
+      query_({what, key}, started);
+    });
+  }
+
+  void query_(const lookup_key& key, pending_lookup& lookup) {
+    if (lookup.sent == retry_delays.size()) {
+      auto failed = std::move(pending_[key]);
+      pending_.erase(key);
+      pending_count_--;
+      complete_(*failed, false,
+                key.first == kind::service ? result{service_info{}}
+                                           : result{host_info{}});
+      return;
+    }
+
+    // Only the first query asks for a unicast response
+    bool unicast = lookup.sent == 0;
+    std::vector<question> questions;
+    if (key.first == kind::service) {
+      questions.push_back({lookup.name, message::SRV, unicast});
+      questions.push_back({lookup.name, message::TXT, unicast});
+    } else {
+      questions.push_back({lookup.name, message::A, unicast});
+      questions.push_back({lookup.name, message::AAAA, unicast});
+    }
+    send_handler_(destination_, encode_query(questions, {}));
+
+    lookup.timer.expires_after(retry_delays[lookup.sent++]);
+    lookup.timer.async_wait(
+        strand_.wrap([this, key](const boost::system::error_code& ec) {
+          auto itr = pending_.find(key);
+          if (ec == boost::asio::error::operation_aborted ||
+              itr == pending_.end()) {
+            return;
+          }
+
+          // A response that came in before the lookup was pending went
+          // into the cache but past on_response()
+          result answer;
+          if (from_cache_(key.first, itr->second->name, answer)) {
+            auto done = std::move(itr->second);
+            pending_.erase(itr);
+            pending_count_--;
+            complete_(*done, true, answer);
+            return;
+          }
+          query_(key, *itr->second);
+        }));
+  }
+
+  static void complete_(pending_lookup& lookup,
+                        bool found,
+                        const result& answer) {
+    lookup.timer.cancel();
+    for (auto& waiter : lookup.waiters) {
+      waiter(found, answer);
+    }
+  }
+
+  bool from_cache_(kind what, const std::string& name, result& answer) const {
+    return what == kind::service ? service_from_cache_(name, answer)
+                                 : host_from_cache_(name, answer);
+  }
+
+  bool service_from_cache_(const std::string& name, result& answer) const {
+    service_info info{name};
+    bool has_srv = false;
+    bool has_txt = false;
+    cache_.for_each_record(
+        name, message::ANY,
+        [&info, &has_srv, &has_txt](const cached_record& cached) {
+          const auto& rr = *cached.rr;
+          const auto* data = rr.wire.data() + rr.data_offset;
+          if (rr.type == message::SRV) {
+            info.priority = message::read_u16(data);
+            info.weight = message::read_u16(data + 2);
+            info.port = message::read_u16(data + 4);
+            info.host_name = rr.target;
+            has_srv = true;
+          } else if (rr.type == message::TXT) {
+            info.data = parse_txt_(data, rr.wire.data() + rr.wire.size());
+            has_txt = true;
+          }
+        });
+
+    // Either may come first, in a packet of its own
+    if (!has_srv || !has_txt) {
+      return false;
+    }
+    answer = std::move(info);
+    return true;
+  }
+
+  bool host_from_cache_(const std::string& name, result& answer) const {
+    host_info info{name};
+    cache_.for_each_record(
+        name, message::ANY, [&info](const cached_record& cached) {
+          const auto& rr = *cached.rr;
+          const auto* data = rr.wire.data() + rr.data_offset;
+          const size_t data_size = rr.wire.size() - rr.data_offset;
+          if (rr.type == message::A && data_size == 4) {
+            boost::asio::ip::address_v4::bytes_type bytes;
+            std::copy_n(data, bytes.size(), bytes.begin());
+            info.addresses.emplace_back(boost::asio::ip::address_v4(bytes));
+          } else if (rr.type == message::AAAA && data_size == 16) {
+            boost::asio::ip::address_v6::bytes_type bytes;
+            std::copy_n(data, bytes.size(), bytes.begin());
+            info.addresses.emplace_back(boost::asio::ip::address_v6(bytes));
+          }
+        });
+
+    if (info.addresses.empty()) {
+      return false;
+    }
+    answer = std::move(info);
+    return true;
+  }
+
+  // Length prefixed key=value strings, RFC 6763 §6
+  static std::vector<std::pair<std::string, std::string>> parse_txt_(
+      const net::net_stream_data* data,
+      const net::net_stream_data* end) {
+    std::vector<std::pair<std::string, std::string>> values;
+    message::for_each_txt_entry(
+        data, end - data,
+        [&values](std::string_view key, std::string_view value) {
+          values.emplace_back(key, value);
+        });
+    return values;
+  }
+
+  // Between the queries of a lookup, and from the last one to giving up
+  static constexpr std::array<std::chrono::milliseconds, 3> retry_delays = {
+      std::chrono::milliseconds(1000), std::chrono::milliseconds(2000),
+      std::chrono::milliseconds(3000)};
+
+  boost::asio::io_context& io_ctx_;
+  boost::asio::io_context::strand& strand_;
+  const record_cache& cache_;
+  const endpoint destination_;
+  send_handler send_handler_;
+
+  std::atomic<size_t> pending_count_;
+  std::unordered_map<lookup_key,
+                     std::unique_ptr<pending_lookup>,
+                     lookup_key_hash>
+      pending_;
+};
+
+}  // namespace mmdns::client
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_service_register.hpp"
+
+namespace mmdns::service {
+
+// The records picked to answer one or more queries
+struct response {
+  using record_ptr = std::shared_ptr<const record>;
+
+  std::vector<record_ptr> answers;
+  std::vector<record_ptr> additionals;
+  // When the earliest of the queries answered came in
+  detail::clock::time_point received;
+
+  bool empty() const { return answers.empty(); }
+
+  // Answers holding shared records, e.g. PTRs, could come from many
+  // responders at once and go out after a random delay, RFC 6762 §6
+  bool has_shared_answers() const {
+    return std::any_of(answers.begin(), answers.end(),
+                       [](const record_ptr& rr) { return !rr->cache_flush; });
+  }
+
+  void merge(response&& other) {
+    received = std::min(received, other.received);
+
+    auto listed = listed_(answers);
+    for (auto& rr : other.answers) {
+      if (listed.insert(key(*rr)).second) {
+        answers.push_back(std::move(rr));
+      }
+    }
+
+    // A record that is now an answer no longer needs to be an additional
+    additionals.erase(std::remove_if(additionals.begin(), additionals.end(),
+                                     [&listed](const record_ptr& rr) {
+                                       return listed.count(key(*rr)) != 0;
+                                     }),
+                      additionals.end());
+
+    for (const auto& rr : additionals) {
+      listed.insert(key(*rr));
+    }
+    for (auto& rr : other.additionals) {
+      if (listed.insert(key(*rr)).second) {
+        additionals.push_back(std::move(rr));
+      }
+    }
+  }
+
+  // Records with the same key are byte for byte the same RR, TTL included
+  static std::string_view key(const record& rr) {
+    return std::string_view(reinterpret_cast<const char*>(rr.wire.data()),
+                            rr.wire.size());
+  }
+
+ private:
+  static std::unordered_set<std::string_view> listed_(
+      const std::vector<record_ptr>& section) {
+    std::unordered_set<std::string_view> listed;
+    listed.reserve(section.size());
+    for (const auto& rr : section) {
+      listed.insert(key(*rr));
+    }
+    return listed;
+  }
+};
+
+// Chooses the records that answer a query: only the records matching each
+// question's type and class, minus the ones the querier listed as known
+// answers (RFC 6762 §7.1), plus the additional records described in RFC 6762
+// §12.
+class responder {
+ public:
+  static constexpr uint16_t CLASS_IN = 1;
+  static constexpr uint16_t CLASS_ANY = 255;
+
+  responder(const registry& registry) : registry_(registry) {}
+
+  ~responder() = default;
+
+  response respond(const message::mdns_message_t& query) const {
+    response answer;
+
+    // What is in either section so far, so that each candidate costs a
+    // lookup rather than a pass over everything picked before it
+    std::unordered_set<std::string_view> listed;
+    auto add = [&](std::vector<response::record_ptr>& section,
+                   const response::record_ptr& rr) {
+      if (!is_known_answer_(query, *rr) &&
+          listed.insert(response::key(*rr)).second) {
+        section.push_back(rr);
+      }
+    };
+
+    for (const auto& question : query.queries) {
+      if (question.query_class != CLASS_IN &&
+          question.query_class != CLASS_ANY) {
+        continue;
+      }
+
+      registry_.for_each_record(
+          question.name,
+          static_cast<message::mdns_rr_type>(question.query_type),
+          [&](const response::record_ptr& rr) { add(answer.answers, rr); });
+    }
+
+    if (answer.empty()) {
+      return answer;
+    }
+
+    // Additional records may bring in further additional records, e.g. the
+    // SRV record of a PTR answer brings in the addresses of its target
+    auto add_additionals = [&](const record& rr) {
+      auto add_additional = [&](const response::record_ptr& additional) {
+        add(answer.additionals, additional);
+      };
+
+      switch (rr.type) {
+        case message::PTR:
+          registry_.for_each_record(rr.target, message::SRV, add_additional);
+          registry_.for_each_record(rr.target, message::TXT, add_additional);
+          break;
+        case message::SRV:
+          registry_.for_each_record(rr.target, message::A, add_additional);
+          registry_.for_each_record(rr.target, message::AAAA, add_additional);
+          break;
+        case message::A:
+          registry_.for_each_record(rr.name, message::AAAA, add_additional);
+          break;
+        case message::AAAA:
+          registry_.for_each_record(rr.name, message::A, add_additional);
+          break;
+        default:
+          break;
+      }
+    };
+
+    for (size_t idx = 0; idx < answer.answers.size(); idx++) {
+      add_additionals(*answer.answers[idx]);
+    }
+
+    for (size_t idx = 0; idx < answer.additionals.size(); idx++) {
+      add_additionals(*answer.additionals[idx]);
+    }
+
+    return answer;
+  }
+
+ private:
+  // The querier already holds |rr| with at least half of its TTL left
+  static bool is_known_answer_(const message::mdns_message_t& query,
+                               const record& rr) {
+    return std::any_of(query.answers.begin(), query.answers.end(),
+                       [&rr](const message::mdns_rr_t& known_answer) {
+                         return known_answer.ttl >= rr.ttl / 2 &&
+                                rr.matches(known_answer);
+                       });
+  }
+
+  const registry& registry_;
+};
+
+}  // namespace mmdns::service
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_encoder.hpp"
+#include "mdns_service_responder.hpp"
+
+namespace mmdns::service {
+
+// Holds responses back for the RFC 6762 §6 delay and aggregates everything due
+// to the same destination into as few packets as fit in the MTU. Answers that
+// another responder sends first (RFC 6762 §7.4), and records multicast less
+// than a second ago, are dropped on the way.
+//
+// Not thread safe, every call has to come through |strand|.
+class scheduler {
+ public:
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using packet = std::shared_ptr<const std::vector<net::net_stream_data>>;
+  using clock = detail::clock;
+  // Also gets when the earliest query the packets answer came in
+  using send_handler = std::function<
+      void(const endpoint&, std::vector<packet>&&, clock::time_point)>;
+
+  // Keep responses within an Ethernet frame, RFC 6762 §17
+  static constexpr size_t MAX_PACKET_SIZE = 1472;
+
+  scheduler(boost::asio::io_context& io_ctx,
+            boost::asio::io_context::strand& strand,
+            send_handler handler)
+      : io_ctx_(io_ctx),
+        strand_(strand),
+        send_handler_(std::move(handler)),
+        gen_(detail::random_seed()),
+        pending_(),
+        last_multicast_() {}
+
+  ~scheduler() = default;
+
+  void schedule(const endpoint& destination, response&& answer) {
+    if (answer.empty()) {
+      return;
+    }
+
+    // Unique answers go out right away, anything else after 20-120 ms
+    auto deadline = clock::now();
+    if (answer.has_shared_answers()) {
+      std::uniform_int_distribution<> delay(20, 120);
+      deadline += std::chrono::milliseconds(delay(gen_));
+    }
+
+    auto [itr, inserted] = pending_.try_emplace(destination);
+    if (inserted) {
+      itr->second = std::make_unique<pending>(io_ctx_);
+      itr->second->answer = std::move(answer);
+    } else {
+      itr->second->answer.merge(std::move(answer));
+      if (itr->second->deadline <= deadline) {
+        return;
+      }
+    }
+
+    itr->second->deadline = deadline;
+    itr->second->timer.expires_at(deadline);
+    itr->second->timer.async_wait(strand_.wrap(
+        [this, destination](const boost::system::error_code& ec) {
+          if (ec != boost::asio::error::operation_aborted) {
+            flush_(destination);
+          }
+        }));
+  }
+
+  // Drops the pending multicast answers that |response|, sent by another
+  // responder, already carries with at least half of our TTL. Returns how
+  // many were dropped.
+  size_t suppress(const message::mdns_message_t& response) {
+    size_t suppressed = 0;
+    for (auto itr = pending_.begin(); itr != pending_.end();) {
+      if (!itr->first.address().is_multicast()) {
+        ++itr;
+        continue;
+      }
+
+      auto& answers = itr->second->answer.answers;
+      const size_t pending_count = answers.size();
+      answers.erase(
+          std::remove_if(answers.begin(), answers.end(),
+                         [&response](const response::record_ptr& rr) {
+                           return std::any_of(
+                               response.answers.begin(),
+                               response.answers.end(),
+                               [&rr](const message::mdns_rr_t& answer) {
+                                 return answer.ttl >= rr->ttl / 2 &&
+                                        rr->matches(answer);
+                               });
+                         }),
+          answers.end());
+      suppressed += pending_count - answers.size();
+
+      if (answers.empty()) {
+        itr->second->timer.cancel();
+        itr = pending_.erase(itr);
+      } else {
+        ++itr;
+      }
+    }
+    return suppressed;
+  }
+
+ private:
+  struct pending {
+    pending(boost::asio::io_context& io_ctx) : timer(io_ctx) {}
+
+    response answer;
+    clock::time_point deadline;
+    detail::timer timer;
+  };
+
+  // When a record last went out to the group. The entry holds on to the
+  // record, its key is a view of the record's wire format.
+  struct multicast {
+    response::record_ptr rr;
+    clock::time_point when;
+  };
+
+  void flush_(const endpoint& destination) {
+    auto itr = pending_.find(destination);
+    if (itr == pending_.end()) {
+      return;
+    }
+
+    auto answer = std::move(itr->second->answer);
+    pending_.erase(itr);
+
+    // A record is multicast at most once per second, RFC 6762 §6
+    const auto now = clock::now();
+    if (destination.address().is_multicast()) {
+      auto recently_sent = [this, now](const response::record_ptr& rr) {
+        auto sent = last_multicast_.find(response::key(*rr));
+        return sent != last_multicast_.end() &&
+               now - sent->second.when < std::chrono::seconds(1);
+      };
+      answer.answers.erase(std::remove_if(answer.answers.begin(),
+                                          answer.answers.end(), recently_sent),
+                           answer.answers.end());
+      answer.additionals.erase(
+          std::remove_if(answer.additionals.begin(), answer.additionals.end(),
+                         recently_sent),
+          answer.additionals.end());
+
+      for (auto sent = last_multicast_.begin();
+           sent != last_multicast_.end();) {
+        sent = now - sent->second.when < std::chrono::seconds(1)
+                   ? std::next(sent)
+                   : last_multicast_.erase(sent);
+      }
+    }
+
+    auto packets = encode_(answer);
+    if (packets.empty()) {
+      return;
+    }
+
+    if (destination.address().is_multicast()) {
+      for (const auto& rr : answer.answers) {
+        // Replaced whole, the key has to be a view of the record kept
+        last_multicast_.erase(response::key(*rr));
+        last_multicast_.emplace(response::key(*rr), multicast{rr, now});
+      }
+    }
+
+    send_handler_(destination, std::move(packets), answer.received);
+  }
+
+  // Lays the answers out over as many packets as needed, names compressed;
+  // additional records go wherever there is room left and are dropped when
+  // there is none
+  static std::vector<packet> encode_(const response& answer) {
+    std::vector<packet> packets;
+    std::vector<bool> additional_sent(answer.additionals.size(), false);
+    codec::compression_table names;
+
+    size_t next_answer = 0;
+    while (next_answer < answer.answers.size()) {
+      auto data =
+          std::make_shared<std::vector<net::net_stream_data>>(MAX_PACKET_SIZE);
+
+      message::mdns_header_t header{};
+      header.flags = message::mdns_header_t::QUERY_MASK |
+                     message::mdns_header_t::AUTHORATIVE_MASK;
+
+      names.clear();
+      codec::mdns_message_encoder encoder{data->data(), data->size(), &names};
+      encoder.encode_header(header);
+
+      for (; next_answer < answer.answers.size(); next_answer++) {
+        const auto& rr = *answer.answers[next_answer];
+        if (!encoder.encode_rr(rr.wire.data(), rr.wire.size(), rr.data_offset,
+                               rr.ttl)) {
+          break;
+        }
+        header.answer_count++;
+      }
+
+      if (header.answer_count == 0) {
+        // Larger than a packet on its own
+        next_answer++;
+        continue;
+      }
+
+      for (size_t idx = 0; idx < answer.additionals.size(); idx++) {
+        const auto& rr = *answer.additionals[idx];
+        if (!additional_sent[idx] &&
+            encoder.encode_rr(rr.wire.data(), rr.wire.size(), rr.data_offset,
+                              rr.ttl)) {
+          additional_sent[idx] = true;
+          header.additional_rr_count++;
+        }
+      }
+
+      codec::mdns_message_encoder header_encoder{data->data(), data->size()};
+      header_encoder.encode_header(header);
+      data->resize(encoder.get_size());
+      packets.push_back(std::move(data));
+    }
+
+    return packets;
+  }
+
+  boost::asio::io_context& io_ctx_;
+  boost::asio::io_context::strand& strand_;
+  send_handler send_handler_;
+  std::mt19937 gen_;
+
+  std::map<endpoint, std::unique_ptr<pending>> pending_;
+  // By the record's wire format rather than its address: a record that is
+  // withdrawn and published again is still the same record, and another one
+  // allocated where it was isn't
+  std::unordered_map<std::string_view, multicast> last_multicast_;
+};
+
+}  // namespace mmdns::service
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace mmdns::net {
+
+// Serves a text dump on a local Unix socket: every request gets a minimal
+// HTTP response with whatever |render| returns at that moment, and is closed.
+// Enough for a Prometheus scrape through a proxy or for
+//   curl --unix-socket /run/mmdnsd/metrics.sock http://localhost/metrics
+class metrics_endpoint {
+ public:
+  using renderer = std::function<std::string()>;
+  using protocol = boost::asio::local::stream_protocol;
+
+  metrics_endpoint(boost::asio::io_context& io_ctx, renderer render)
+      : io_ctx_(io_ctx), acceptor_(io_ctx), render_(std::move(render)) {}
+
+  ~metrics_endpoint() { stop(); }
+
+  // Replaces whatever socket file a previous run left at |path|
+  bool listen(const std::string& path) {
+    boost::system::error_code ec;
+    ::unlink(path.c_str());
+    acceptor_.open(protocol(), ec);
+    if (!ec) {
+      acceptor_.bind(protocol::endpoint(path), ec);
+    }
+    if (!ec) {
+      acceptor_.listen(boost::asio::socket_base::max_listen_connections, ec);
+    }
+    if (ec) {
+      acceptor_.close(ec);
+      return false;
+    }
+
+    path_ = path;
+    accept_();
+    return true;
+  }
+
+  void stop() {
+    if (!acceptor_.is_open()) {
+      return;
+    }
+
+    boost::system::error_code ignored;
+    acceptor_.close(ignored);
+    ::unlink(path_.c_str());
+  }
+
+ private:
+  static constexpr size_t max_request_size = 4096;
+
+  void accept_() {
+    auto peer = std::make_shared<protocol::socket>(io_ctx_);
+    acceptor_.async_accept(
+        *peer, [this, peer](const boost::system::error_code& ec) {
+          if (ec == boost::asio::error::operation_aborted) {
+            return;
+          }
+
+          if (!ec) {
+            read_request_(peer);
+          }
+          accept_();
+        });
+  }
+
+  // Whatever was asked for gets the same answer, but closing before the
+  // request is read would reset the connection under the client
+  void read_request_(const std::shared_ptr<protocol::socket>& peer) {
+    auto request = std::make_shared<boost::asio::streambuf>(max_request_size);
+    boost::asio::async_read_until(
+        *peer, *request, "\r\n\r\n",
+        [this, peer, request](const boost::system::error_code& ec, size_t) {
+          if (!ec) {
+            respond_(peer);
+          }
+        });
+  }
+
+  void respond_(const std::shared_ptr<protocol::socket>& peer) {
+    auto body = render_();
+    auto response = std::make_shared<std::string>(
+        "HTTP/1.0 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: " +
+        std::to_string(body.size()) + "\r\n\r\n" + body);
+    boost::asio::async_write(
+        *peer, boost::asio::buffer(*response),
+        [peer, response](const boost::system::error_code&, size_t) {
+          boost::system::error_code ignored;
+          peer->shutdown(protocol::socket::shutdown_both, ignored);
+        });
+  }
+
+  boost::asio::io_context& io_ctx_;
+  protocol::acceptor acceptor_;
+  renderer render_;
+  std::string path_;
+};
+
+}  // namespace mmdns::net
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
+
+#include "../detail/clock.hpp"
+#include "net_steam.hpp"
+
+namespace mmdns::net {
+
+// Largest mDNS message, RFC 6762 §17
+constexpr size_t max_datagram_size = 9000;
+
+struct datagram {
+  net_stream_data data[max_datagram_size];
+  size_t size;
+  boost::asio::ip::udp::endpoint sender;
+  detail::clock::time_point received;
+};
+
+using datagram_ptr = std::shared_ptr<datagram>;
+
+// Hands out datagram buffers that go back to the pool once the last owner is
+// done with them, so every packet can own its buffer while any thread decodes
+// it, without allocating 9000 bytes per packet. The pool must outlive them.
+//
+// Up to |max_free| buffers are kept for reuse, a burst that needed more gives
+// the rest back to the allocator.
+class datagram_pool {
+ public:
+  explicit datagram_pool(size_t max_free = 256) : max_free_(max_free) {}
+  ~datagram_pool() = default;
+
+  datagram_ptr acquire() {
+    std::unique_ptr<datagram> buffer;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        buffer = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+
+    if (!buffer) {
+      buffer = std::make_unique<datagram>();
+    }
+
+    return datagram_ptr(buffer.release(), [this](datagram* released) {
+      std::unique_ptr<datagram> buffer(released);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (free_.size() < max_free_) {
+        free_.push_back(std::move(buffer));
+      }
+    });
+  }
+
+ private:
+  const size_t max_free_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<datagram>> free_;
+};
+
+struct outgoing_datagram {
+  boost::asio::ip::udp::endpoint destination;
+  std::shared_ptr<const std::vector<net_stream_data>> data;
+  // When the query this answers came in, if it answers one
+  detail::clock::time_point answers_query_from;
+};
+
+// Reads every datagram the socket has queued, up to the size of |batch|, with
+// a single recvmmsg where available. Returns how many were read; the socket is
+// never blocked on. Every slot in |batch| must hold a buffer.
+inline size_t receive_batch(boost::asio::ip::udp::socket& socket,
+                            std::vector<datagram_ptr>& batch) {
+#ifdef __linux__
+  std::vector<mmsghdr> headers(batch.size());
+  std::vector<iovec> buffers(batch.size());
+
+  for (size_t idx = 0; idx < batch.size(); idx++) {
+    buffers[idx] = {batch[idx]->data, sizeof(batch[idx]->data)};
+    headers[idx] = {};
+    headers[idx].msg_hdr.msg_name = batch[idx]->sender.data();
+    headers[idx].msg_hdr.msg_namelen = batch[idx]->sender.capacity();
+    headers[idx].msg_hdr.msg_iov = &buffers[idx];
+    headers[idx].msg_hdr.msg_iovlen = 1;
+  }
+
+  int received = recvmmsg(socket.native_handle(), headers.data(),
+                          headers.size(), MSG_DONTWAIT, nullptr);
+  if (received <= 0) {
+    return 0;
+  }
+
+  const auto now = detail::clock::now();
+  for (int idx = 0; idx < received; idx++) {
+    batch[idx]->size = headers[idx].msg_len;
+    batch[idx]->sender.resize(headers[idx].msg_hdr.msg_namelen);
+    batch[idx]->received = now;
+  }
+
+  return received;
+#else
+  size_t received = 0;
+  boost::system::error_code ec;
+  for (; received < batch.size(); received++) {
+    auto& slot = *batch[received];
+    slot.size = socket.receive_from(
+        boost::asio::buffer(slot.data, sizeof(slot.data)), slot.sender, 0, ec);
+    if (ec) {
+      break;
+    }
+    slot.received = detail::clock::now();
+  }
+  return received;
+#endif
+}
+
+// Sends |count| datagrams with as few sendmmsg calls as possible. Returns how
+// many left, which is less than |count| only when the socket buffer is full.
+// Datagrams the kernel refuses for any other reason are dropped.
+inline size_t send_batch(boost::asio::ip::udp::socket& socket,
+                         const outgoing_datagram* datagrams,
+                         size_t count) {
+  size_t sent = 0;
+#ifdef __linux__
+  std::vector<mmsghdr> headers(count);
+  std::vector<iovec> buffers(count);
+
+  for (size_t idx = 0; idx < count; idx++) {
+    auto& destination = datagrams[idx].destination;
+    buffers[idx] = {const_cast<net_stream_data*>(datagrams[idx].data->data()),
+                    datagrams[idx].data->size()};
+    headers[idx] = {};
+    headers[idx].msg_hdr.msg_name = const_cast<void*>(
+        static_cast<const void*>(destination.data()));
+    headers[idx].msg_hdr.msg_namelen = destination.size();
+    headers[idx].msg_hdr.msg_iov = &buffers[idx];
+    headers[idx].msg_hdr.msg_iovlen = 1;
+  }
+
+  while (sent < count) {
+    int result = sendmmsg(socket.native_handle(), headers.data() + sent,
+                          count - sent, MSG_DONTWAIT);
+    if (result > 0) {
+      sent += result;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    } else if (errno != EINTR) {
+      sent++;
+    }
+  }
+#else
+  boost::system::error_code ec;
+  for (; sent < count; sent++) {
+    socket.send_to(boost::asio::buffer(*datagrams[sent].data),
+                   datagrams[sent].destination, 0, ec);
+    if (ec == boost::asio::error::would_block) {
+      break;
+    }
+  }
+#endif
+  return sent;
+}
+
+}  // namespace mmdns::net
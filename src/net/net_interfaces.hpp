@@ -0,0 +1,297 @@
+#pragma once
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#else
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#endif
+
+namespace mmdns::net {
+
+// The addresses of the host's interfaces, read straight from the kernel so
+// that nothing waits on the system resolver. On Linux a netlink socket keeps
+// them current and reports every change; elsewhere they are read once with
+// getifaddrs.
+//
+// Loopback addresses are only handed out while the host has no other.
+//
+// Given a |fixed| list instead, it hands that out and never asks the kernel,
+// for a host that isn't this one, like one in a simulation.
+class address_provider {
+ public:
+  using address_list = std::vector<boost::asio::ip::address>;
+  using change_handler = std::function<void(const address_list&)>;
+
+  explicit address_provider(
+      boost::asio::io_context& io_ctx,
+      std::optional<address_list> fixed = std::nullopt)
+      : descriptor_(io_ctx),
+        mutex_(),
+        known_(),
+        addresses_(fixed.value_or(address_list())),
+        fixed_(fixed.has_value()),
+        handler_() {}
+
+  ~address_provider() { stop(); }
+
+  // Reads the current addresses, which is a quick round trip to the kernel,
+  // and from then on calls |handler| with the new list after every change
+  void start(change_handler handler) {
+    handler_ = std::move(handler);
+    if (fixed_) {
+      return;
+    }
+
+#ifdef __linux__
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+      return;
+    }
+
+    sockaddr_nl local{};
+    local.nl_family = AF_NETLINK;
+    local.nl_groups = RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)) != 0) {
+      close(fd);
+      return;
+    }
+
+    struct {
+      nlmsghdr header;
+      ifaddrmsg body;
+    } request{};
+    request.header.nlmsg_len = sizeof(request);
+    request.header.nlmsg_type = RTM_GETADDR;
+    request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    request.header.nlmsg_seq = 1;
+    request.body.ifa_family = AF_UNSPEC;
+    if (send(fd, &request, sizeof(request), 0) < 0) {
+      close(fd);
+      return;
+    }
+
+    // The dump comes back in one or more batches ending with NLMSG_DONE. A
+    // kernel that never finishes it doesn't hold the caller up for more than
+    // a second a batch; whatever comes after is read like any change.
+    timeval timeout{};
+    timeout.tv_sec = 1;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    bool done = false;
+    while (!done) {
+      auto received = recv(fd, buffer_, sizeof(buffer_), 0);
+      if (received <= 0) {
+        break;
+      }
+      done = parse_(buffer_, received);
+    }
+
+    descriptor_.assign(fd);
+    descriptor_.non_blocking(true);
+    async_wait_();
+#else
+    ifaddrs* interfaces = nullptr;
+    if (getifaddrs(&interfaces) != 0) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto* itr = interfaces; itr != nullptr; itr = itr->ifa_next) {
+      if (itr->ifa_addr == nullptr || !(itr->ifa_flags & IFF_UP)) {
+        continue;
+      }
+
+      if (itr->ifa_addr->sa_family == AF_INET) {
+        auto* ipv4 = reinterpret_cast<sockaddr_in*>(itr->ifa_addr);
+        boost::asio::ip::address_v4::bytes_type bytes;
+        std::memcpy(bytes.data(), &ipv4->sin_addr, bytes.size());
+        known_[{if_nametoindex(itr->ifa_name), bytes.data(), 4}] =
+            boost::asio::ip::address_v4(bytes);
+      } else if (itr->ifa_addr->sa_family == AF_INET6) {
+        auto* ipv6 = reinterpret_cast<sockaddr_in6*>(itr->ifa_addr);
+        boost::asio::ip::address_v6::bytes_type bytes;
+        std::memcpy(bytes.data(), &ipv6->sin6_addr, bytes.size());
+        known_[{if_nametoindex(itr->ifa_name), bytes.data(), 16}] =
+            boost::asio::ip::address_v6(bytes, ipv6->sin6_scope_id);
+      }
+    }
+    freeifaddrs(interfaces);
+    addresses_ = select_();
+#endif
+  }
+
+  void stop() {
+    boost::system::error_code ignored;
+    descriptor_.close(ignored);
+  }
+
+  address_list addresses() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return addresses_;
+  }
+
+ private:
+  // Interface index and address bytes
+  struct address_key {
+    address_key(uint32_t index, const uint8_t* data, size_t size)
+        : index(index), bytes(data, data + size) {}
+
+    bool operator<(const address_key& other) const {
+      return std::tie(index, bytes) < std::tie(other.index, other.bytes);
+    }
+
+    uint32_t index;
+    std::vector<uint8_t> bytes;
+  };
+
+  address_list select_() const {
+    address_list selected;
+    for (const auto& [key, address] : known_) {
+      if (!address.is_loopback()) {
+        selected.push_back(address);
+      }
+    }
+
+    if (selected.empty()) {
+      for (const auto& [key, address] : known_) {
+        selected.push_back(address);
+      }
+    }
+
+    std::sort(selected.begin(), selected.end());
+    selected.erase(std::unique(selected.begin(), selected.end()),
+                   selected.end());
+    return selected;
+  }
+
+#ifdef __linux__
+  void async_wait_() {
+    descriptor_.async_wait(
+        boost::asio::posix::stream_descriptor::wait_read,
+        [this](const boost::system::error_code& ec) {
+          if (ec) {
+            return;
+          }
+
+          auto before = addresses();
+          ssize_t received;
+          while ((received = recv(descriptor_.native_handle(), buffer_,
+                                  sizeof(buffer_), MSG_DONTWAIT)) > 0) {
+            parse_(buffer_, received);
+          }
+
+          auto after = addresses();
+          if (after != before && handler_) {
+            handler_(after);
+          }
+
+          async_wait_();
+        });
+  }
+
+  // Applies every address message in |data|, returns whether the dump ended
+  bool parse_(const uint8_t* data, size_t size) {
+    bool done = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto remaining = static_cast<unsigned int>(size);
+      for (auto* header = reinterpret_cast<const nlmsghdr*>(data);
+           NLMSG_OK(header, remaining);
+           header = NLMSG_NEXT(header, remaining)) {
+        if (header->nlmsg_type == NLMSG_DONE ||
+            header->nlmsg_type == NLMSG_ERROR) {
+          done = true;
+          break;
+        }
+
+        if (header->nlmsg_type == RTM_NEWADDR ||
+            header->nlmsg_type == RTM_DELADDR) {
+          apply_(header);
+        }
+      }
+      addresses_ = select_();
+    }
+    return done;
+  }
+
+  void apply_(const nlmsghdr* header) {
+    const auto* body = reinterpret_cast<const ifaddrmsg*>(NLMSG_DATA(header));
+    if (body->ifa_family != AF_INET && body->ifa_family != AF_INET6) {
+      return;
+    }
+
+    // IPv4 point-to-point links carry the peer in IFA_ADDRESS and our own
+    // address in IFA_LOCAL
+    const rtattr* address = nullptr;
+    const rtattr* local = nullptr;
+    auto length = IFA_PAYLOAD(header);
+    for (auto* attribute = IFA_RTA(body); RTA_OK(attribute, length);
+         attribute = RTA_NEXT(attribute, length)) {
+      if (attribute->rta_type == IFA_ADDRESS) {
+        address = attribute;
+      } else if (attribute->rta_type == IFA_LOCAL) {
+        local = attribute;
+      }
+    }
+
+    if (local != nullptr) {
+      address = local;
+    }
+
+    const size_t size = body->ifa_family == AF_INET ? 4 : 16;
+    if (address == nullptr || RTA_PAYLOAD(address) != size) {
+      return;
+    }
+
+    const auto* bytes = reinterpret_cast<const uint8_t*>(RTA_DATA(address));
+    address_key key{body->ifa_index, bytes, size};
+
+    // Addresses still going through duplicate address detection aren't ours
+    // yet
+    if (header->nlmsg_type == RTM_DELADDR ||
+        (body->ifa_flags & (IFA_F_TENTATIVE | IFA_F_DADFAILED)) != 0) {
+      known_.erase(key);
+      return;
+    }
+
+    if (size == 4) {
+      boost::asio::ip::address_v4::bytes_type ipv4;
+      std::copy_n(bytes, ipv4.size(), ipv4.begin());
+      known_[key] = boost::asio::ip::address_v4(ipv4);
+    } else {
+      boost::asio::ip::address_v6::bytes_type ipv6;
+      std::copy_n(bytes, ipv6.size(), ipv6.begin());
+      known_[key] = boost::asio::ip::address_v6(ipv6);
+    }
+  }
+
+  uint8_t buffer_[16384];
+#endif
+
+  boost::asio::posix::stream_descriptor descriptor_;
+  mutable std::mutex mutex_;
+  std::map<address_key, boost::asio::ip::address> known_;
+  address_list addresses_;
+  const bool fixed_;
+  change_handler handler_;
+};
+
+}  // namespace mmdns::net
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace mmdns::net {
+
+// Helpers to run one socket per core on the mDNS port. Linux only, elsewhere
+// they do nothing and return false.
+
+inline bool enable_reuseport(boost::asio::ip::udp::socket& socket) {
+#if defined(__linux__) && defined(SO_REUSEPORT)
+  int enable = 1;
+  return setsockopt(socket.native_handle(), SOL_SOCKET, SO_REUSEPORT, &enable,
+                    sizeof(enable)) == 0;
+#else
+  return false;
+#endif
+}
+
+// SO_REUSEPORT only balances unicast: the kernel hands a copy of every
+// multicast datagram to each socket in the group. This filter keeps the
+// multicast datagrams whose IPv4 source address falls in |shard_index| modulo
+// |shard_count| and every unicast one, so each datagram is only queued on
+// one shard.
+inline bool attach_shard_filter(boost::asio::ip::udp::socket& socket,
+                                uint32_t mdns_group,
+                                uint32_t shard_index,
+                                uint32_t shard_count) {
+#ifdef __linux__
+  constexpr uint32_t destination_offset = SKF_NET_OFF + 16;
+  constexpr uint32_t source_offset = SKF_NET_OFF + 12;
+  sock_filter code[] = {
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, destination_offset),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mdns_group, 0, 3),
+      BPF_STMT(BPF_LD | BPF_W | BPF_ABS, source_offset),
+      BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, shard_count),
+      BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, shard_index, 0, 1),
+      BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+      BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  sock_fprog program{sizeof(code) / sizeof(code[0]), code};
+  return setsockopt(socket.native_handle(), SOL_SOCKET, SO_ATTACH_FILTER,
+                    &program, sizeof(program)) == 0;
+#else
+  return false;
+#endif
+}
+
+// Opens |copy| on a second descriptor for |socket|. It is the same socket,
+// not one more in its SO_REUSEPORT group for the kernel to hand unicast
+// datagrams to, so a thread that only sends can wait on it with an
+// io_context of its own.
+inline bool duplicate_socket(boost::asio::ip::udp::socket& socket,
+                             boost::asio::ip::udp::socket& copy) {
+#ifdef __linux__
+  const int descriptor = dup(socket.native_handle());
+  if (descriptor < 0) {
+    return false;
+  }
+
+  boost::system::error_code ec;
+  copy.assign(boost::asio::ip::udp::v4(), descriptor, ec);
+  if (ec) {
+    close(descriptor);
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+inline bool pin_to_core(std::thread& thread, size_t core) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(core % std::max(1u, std::thread::hardware_concurrency()), &cpu_set);
+  return pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set),
+                                &cpu_set) == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace mmdns::net
@@ -28,8 +28,10 @@ class net_stream {
     return std::tuple(true, start, data_);
   }
 
+  // Points back at |offset| from the start of the stream, which has to be
+  // within what was already read, e.g. for compression pointers
   std::tuple<bool, const_net_stream_pointer> seek(size_t offset) {
-    if (data_size_ < offset) {
+    if (bytes_read_ < offset) {
       return std::make_tuple(false, nullptr);
     }
 
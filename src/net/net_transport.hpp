@@ -0,0 +1,280 @@
+#pragma once
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "../detail/mdns_log.hpp"
+#include "net_batch.hpp"
+#include "net_interfaces.hpp"
+#include "net_shard.hpp"
+
+namespace mmdns::net {
+
+// What mdns_client reads datagrams from and sends them through, a policy it
+// takes as a template parameter. This one is the mDNS port of the host;
+// sim::transport is the other, on a simulated network in the same process.
+//
+// A transport provides:
+//   config                       what it is constructed from, besides the
+//                                client's io_context, socket strand and
+//                                datagram pool
+//   open(shard_count, handler)   starts reading and hands every datagram to
+//                                handler(const datagram_ptr&), on any thread
+//                                running the io_context
+//   send(datagrams, count)       sends from the front of |datagrams| on the
+//                                socket strand without blocking, and returns
+//                                how many went
+//   async_wait_writable(handler) calls handler(bool ok) on the socket strand
+//                                once send() can make progress again
+//   send_now(destination, data)  sends from the calling thread, for the
+//                                goodbyes on the way out
+//   addresses()                  the addresses to announce, or nullopt for
+//                                those of the host's interfaces
+//   close()                      stops reading and joins its threads
+class udp_transport {
+ public:
+  struct config {};
+
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using receive_handler = std::function<void(const datagram_ptr&)>;
+  using packet = std::shared_ptr<const std::vector<net_stream_data>>;
+  using write_handler = std::function<void(bool)>;
+
+  udp_transport(boost::asio::io_context& io_ctx,
+                boost::asio::io_context::strand& strand,
+                datagram_pool& pool,
+                const config& = {})
+      : io_ctx_(io_ctx),
+        strand_(strand),
+        pool_(pool),
+        socket_(io_ctx),
+        shards_(),
+        in_batch_(receive_batch_size),
+        handler_(),
+        in_flight_(0),
+        paused_(false) {}
+
+  ~udp_transport() { close(); }
+
+  udp_transport(const udp_transport&) = delete;
+  udp_transport& operator=(const udp_transport&) = delete;
+
+  // With |shard_count| above one, and on Linux, every shard gets its own
+  // SO_REUSEPORT socket on the mDNS port and its own io_context on a thread
+  // pinned to a core, and hands datagrams over on that thread. Where that
+  // can't be set up there is one socket, read on the socket strand.
+  void open(size_t shard_count, receive_handler handler) {
+    handler_ = std::move(handler);
+
+    if (shard_count < 2 || !open_shards_(shard_count)) {
+      open_(socket_, false);
+      async_receive_();
+      return;
+    }
+
+    for (size_t idx = 0; idx < shards_.size(); idx++) {
+      auto& listener = *shards_[idx];
+      async_receive_(listener);
+      listener.thread = std::make_unique<std::thread>(
+          [&listener]() { listener.io_ctx.run(); });
+      pin_to_core(*listener.thread, idx);
+    }
+  }
+
+  size_t send(const outgoing_datagram* datagrams, size_t count) {
+    return send_batch(socket_, datagrams, count);
+  }
+
+  void async_wait_writable(write_handler handler) {
+    socket_.async_wait(boost::asio::ip::udp::socket::wait_write,
+                       strand_.wrap([handler = std::move(handler)](
+                                        const boost::system::error_code& ec) {
+                         handler(!ec);
+                       }));
+  }
+
+  // Goodbyes come from the mDNS port too, RFC 6762 §6 has receivers ignore
+  // responses from any other
+  void send_now(const endpoint& destination, const packet& data) {
+    if (!socket_.is_open()) {
+      return;
+    }
+
+    boost::system::error_code ignored;
+    socket_.send_to(boost::asio::buffer(*data), destination, 0, ignored);
+  }
+
+  std::optional<address_provider::address_list> addresses() const {
+    return std::nullopt;
+  }
+
+  void close() {
+    for (auto& listener : shards_) {
+      listener->io_ctx.stop();
+      if (listener->thread) {
+        listener->thread->join();
+      }
+    }
+    shards_.clear();
+  }
+
+ private:
+  // A listener of its own in sharded mode
+  struct shard {
+    shard(size_t batch_size)
+        : io_ctx(), socket(io_ctx), in_batch(batch_size), thread() {}
+
+    boost::asio::io_context io_ctx;
+    boost::asio::ip::udp::socket socket;
+    std::vector<datagram_ptr> in_batch;
+    std::unique_ptr<std::thread> thread;
+  };
+
+  // Datagrams read per readiness notification
+  static constexpr size_t receive_batch_size = 32;
+  // Datagrams read and not yet handled past which reading stops, some 9 MB
+  // of buffers, and below which it starts again
+  static constexpr size_t max_in_flight = 1024;
+  static constexpr size_t resume_in_flight = max_in_flight / 2;
+
+  inline static const boost::asio::ip::address mdns_address =
+      boost::asio::ip::make_address("224.0.0.251");
+  static constexpr unsigned short mdns_port = 5353;
+
+  // Opens the shards' sockets, or none of them. Responses have to come from
+  // the mDNS port, so socket_ sends through the first shard's socket rather
+  // than joining the group: the kernel would hand it a share of the unicast
+  // datagrams, and it reads nothing.
+  bool open_shards_(size_t shard_count) {
+    for (size_t idx = 0; idx < shard_count; idx++) {
+      auto listener = std::make_unique<shard>(receive_batch_size);
+      const bool ready =
+          open_(listener->socket, true) &&
+          attach_shard_filter(listener->socket,
+                              mdns_address.to_v4().to_uint(), idx,
+                              shard_count);
+      shards_.push_back(std::move(listener));
+      if (!ready) {
+        MMDNS_LOG(warning, "Failed to set up shard ", idx,
+                  ", reading from a single socket");
+        shards_.clear();
+        return false;
+      }
+    }
+
+    if (!duplicate_socket(shards_.front()->socket, socket_)) {
+      MMDNS_LOG(warning, "Failed to share the first shard's socket, reading "
+                         "from a single socket");
+      shards_.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // Returns false if |reuseport| is asked for and can't be had
+  bool open_(boost::asio::ip::udp::socket& socket, bool reuseport) {
+    endpoint listen_endpoint(boost::asio::ip::address_v4::any(), mdns_port);
+    socket.open(listen_endpoint.protocol());
+    socket.set_option(boost::asio::ip::udp::socket::reuse_address(true));
+    if (reuseport && !enable_reuseport(socket)) {
+      MMDNS_LOG(warning, "Failed to enable SO_REUSEPORT");
+      return false;
+    }
+    socket.set_option(boost::asio::ip::multicast::join_group(mdns_address));
+    socket.bind(listen_endpoint);
+    socket.non_blocking(true);
+    return true;
+  }
+
+  void async_receive_() {
+    socket_.async_wait(
+        boost::asio::ip::udp::socket::wait_read,
+        strand_.wrap([this](const boost::system::error_code& ec) {
+          on_readable_(ec);
+        }));
+  }
+
+  void on_readable_(const boost::system::error_code& ec) {
+    if (ec) {
+      return;
+    }
+
+    for (auto& slot : in_batch_) {
+      if (!slot) {
+        slot = pool_.acquire();
+      }
+    }
+
+    // Each datagram leaves the batch with its buffer and is decoded on
+    // whichever thread gets to it first
+    auto received = receive_batch(socket_, in_batch_);
+    for (size_t idx = 0; idx < received; idx++) {
+      in_flight_++;
+      io_ctx_.post([this, datagram = std::move(in_batch_[idx])]() {
+        handler_(datagram);
+        on_handled_();
+      });
+    }
+
+    // With the pool behind, reading stops and the kernel drops what doesn't
+    // fit the socket buffer instead of us queueing it all. A handler that
+    // finds reading stopped after the flag is set starts it again, otherwise
+    // whichever of the two takes the flag back does.
+    if (in_flight_ >= max_in_flight) {
+      paused_ = true;
+      if (in_flight_ >= resume_in_flight || !paused_.exchange(false)) {
+        return;
+      }
+    }
+
+    async_receive_();
+  }
+
+  void on_handled_() {
+    if (--in_flight_ < resume_in_flight && paused_.exchange(false)) {
+      strand_.post([this]() { async_receive_(); });
+    }
+  }
+
+  void async_receive_(shard& listener) {
+    listener.socket.async_wait(
+        boost::asio::ip::udp::socket::wait_read,
+        [this, &listener](const boost::system::error_code& ec) {
+          if (ec) {
+            return;
+          }
+
+          for (auto& slot : listener.in_batch) {
+            if (!slot) {
+              slot = pool_.acquire();
+            }
+          }
+
+          // Already on a core of its own, the shard answers in place
+          auto received = receive_batch(listener.socket, listener.in_batch);
+          for (size_t idx = 0; idx < received; idx++) {
+            auto datagram = std::move(listener.in_batch[idx]);
+            handler_(datagram);
+          }
+
+          async_receive_(listener);
+        });
+  }
+
+  boost::asio::io_context& io_ctx_;
+  boost::asio::io_context::strand& strand_;
+  datagram_pool& pool_;
+  boost::asio::ip::udp::socket socket_;
+  std::vector<std::unique_ptr<shard>> shards_;
+  std::vector<datagram_ptr> in_batch_;
+  receive_handler handler_;
+  std::atomic<size_t> in_flight_;
+  std::atomic<bool> paused_;
+};
+
+}  // namespace mmdns::net
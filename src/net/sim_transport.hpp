@@ -0,0 +1,296 @@
+#pragma once
+
+#include <boost/asio.hpp>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <vector>
+
+#include "../detail/clock.hpp"
+#include "net_batch.hpp"
+#include "net_interfaces.hpp"
+
+namespace mmdns::net::sim {
+
+// A multicast link between clients in the same process, in virtual time.
+// Every client gets an address of its own and a net::sim::transport on the
+// bus; a datagram sent to the mDNS group reaches all of them, the sender too
+// like IP_MULTICAST_LOOP has it, and one sent to an address reaches that
+// client, |latency| after it was sent.
+//
+// The bus takes over detail::clock and seeds the random delays while it
+// exists, so the clients on it can't run next to real ones. Nothing runs by
+// itself: run_until() hands datagrams over and polls the clients, on the
+// calling thread, and moves time on by |step| once none of them has anything
+// left to do. Given the same seed and the same calls, a run plays out the
+// same way every time.
+class bus {
+ public:
+  using clock = detail::clock;
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using packet = std::shared_ptr<const std::vector<net_stream_data>>;
+  using deliver_handler =
+      std::function<void(const endpoint& sender, const packet& data)>;
+  using poll_handler = std::function<size_t()>;
+
+  explicit bus(uint64_t seed = 1,
+               clock::duration latency = std::chrono::microseconds(100),
+               clock::duration step = std::chrono::milliseconds(1))
+      : latency_(latency),
+        step_(step),
+        hosts_(),
+        polls_(),
+        in_flight_(),
+        sequence_(0),
+        packets_sent_(0),
+        deliveries_(0) {
+    // Time starts past the epoch, a zero time point means "never" to some
+    clock::simulate(clock::time_point(std::chrono::hours(1)));
+    detail::seed_randomness(seed);
+  }
+
+  ~bus() { clock::stop_simulating(); }
+
+  bus(const bus&) = delete;
+  bus& operator=(const bus&) = delete;
+
+  // Gives a new host an address, 10.0.0.1 and on. It hears nothing until
+  // listen() is called with it.
+  boost::asio::ip::address attach() {
+    const uint32_t host = 0x0a000000 + static_cast<uint32_t>(hosts_.size()) + 1;
+    hosts_.push_back({boost::asio::ip::address_v4(host), {}});
+    return hosts_.back().address;
+  }
+
+  void listen(const boost::asio::ip::address& address,
+              deliver_handler handler) {
+    if (auto* host = find_(address)) {
+      host->handler = std::move(handler);
+    }
+  }
+
+  void detach(const boost::asio::ip::address& address) {
+    if (auto* host = find_(address)) {
+      host->handler = nullptr;
+    }
+  }
+
+  // |poll| runs whatever a client has ready and returns how much that was
+  void drive(poll_handler poll) { polls_.push_back(std::move(poll)); }
+
+  void send(const boost::asio::ip::address& from,
+            const endpoint& destination,
+            packet data) {
+    packets_sent_++;
+    in_flight_.push({clock::now() + latency_, sequence_++,
+                     endpoint(from, mdns_port), destination, std::move(data)});
+  }
+
+  // Runs until |deadline| in virtual time, or until |done| returns true
+  // between two steps. Returns whether |done| did.
+  bool run_until(clock::time_point deadline,
+                 const std::function<bool()>& done = {}) {
+    for (;;) {
+      settle_();
+      if (done && done()) {
+        return true;
+      }
+
+      const auto now = clock::now();
+      if (now >= deadline) {
+        return false;
+      }
+
+      auto next = std::min(now + step_, deadline);
+      if (!in_flight_.empty() && in_flight_.top().due < next) {
+        next = in_flight_.top().due;
+      }
+      clock::advance_to(next);
+    }
+  }
+
+  bool run_for(clock::duration duration,
+               const std::function<bool()>& done = {}) {
+    return run_until(clock::now() + duration, done);
+  }
+
+  // Datagrams sent, and copies of them handed to a host
+  uint64_t packets_sent() const { return packets_sent_; }
+  uint64_t deliveries() const { return deliveries_; }
+
+ private:
+  struct host {
+    boost::asio::ip::address address;
+    deliver_handler handler;
+  };
+
+  struct in_flight {
+    clock::time_point due;
+    uint64_t sequence;
+    endpoint sender;
+    endpoint destination;
+    packet data;
+
+    // Earliest first, and in the order sent when due together
+    bool operator>(const in_flight& other) const {
+      return due != other.due ? due > other.due : sequence > other.sequence;
+    }
+  };
+
+  static constexpr unsigned short mdns_port = 5353;
+  inline static const boost::asio::ip::address mdns_address =
+      boost::asio::ip::make_address("224.0.0.251");
+
+  host* find_(const boost::asio::ip::address& address) {
+    if (!address.is_v4()) {
+      return nullptr;
+    }
+
+    const size_t idx = address.to_v4().to_uint() - 0x0a000000 - 1;
+    return idx < hosts_.size() ? &hosts_[idx] : nullptr;
+  }
+
+  // Hands over what is due and polls every host until none has anything
+  // left to do at this point in time
+  void settle_() {
+    bool progress = true;
+    while (progress) {
+      progress = deliver_due_() > 0;
+      for (auto& poll : polls_) {
+        progress = poll() > 0 || progress;
+      }
+    }
+  }
+
+  size_t deliver_due_() {
+    size_t delivered = 0;
+    const auto now = clock::now();
+    while (!in_flight_.empty() && in_flight_.top().due <= now) {
+      const auto next = in_flight_.top();
+      in_flight_.pop();
+
+      if (next.destination.address() == mdns_address) {
+        for (auto& target : hosts_) {
+          delivered += deliver_(target, next);
+        }
+      } else if (auto* target = find_(next.destination.address())) {
+        delivered += deliver_(*target, next);
+      }
+    }
+    deliveries_ += delivered;
+    return delivered;
+  }
+
+  static size_t deliver_(host& target, const in_flight& datagram) {
+    if (!target.handler) {
+      return 0;
+    }
+
+    target.handler(datagram.sender, datagram.data);
+    return 1;
+  }
+
+  const clock::duration latency_;
+  const clock::duration step_;
+  std::vector<host> hosts_;
+  std::vector<poll_handler> polls_;
+  std::priority_queue<in_flight, std::vector<in_flight>, std::greater<>>
+      in_flight_;
+  uint64_t sequence_;
+  uint64_t packets_sent_;
+  uint64_t deliveries_;
+};
+
+// The transport of a client on a sim::bus, see net::udp_transport for the
+// interface. The client has to be opened with open() and driven by the bus,
+// not started: it has no socket for threads of its own to wait on.
+class transport {
+ public:
+  struct config {
+    bus* network = nullptr;
+  };
+
+  using endpoint = boost::asio::ip::udp::endpoint;
+  using receive_handler = std::function<void(const datagram_ptr&)>;
+  using packet = bus::packet;
+  using write_handler = std::function<void(bool)>;
+
+  transport(boost::asio::io_context& io_ctx,
+            boost::asio::io_context::strand& strand,
+            datagram_pool& pool,
+            const config& settings)
+      : io_ctx_(io_ctx),
+        strand_(strand),
+        pool_(pool),
+        bus_(settings.network),
+        address_(),
+        handler_() {
+    assert(bus_ != nullptr);
+    address_ = bus_->attach();
+  }
+
+  ~transport() { close(); }
+
+  transport(const transport&) = delete;
+  transport& operator=(const transport&) = delete;
+
+  // There is one reader whatever |shard_count| is
+  void open(size_t /*shard_count*/, receive_handler handler) {
+    handler_ = std::move(handler);
+    bus_->listen(address_, [this](const endpoint& sender, const packet& data) {
+      on_delivery_(sender, data);
+    });
+  }
+
+  size_t send(const outgoing_datagram* datagrams, size_t count) {
+    for (size_t idx = 0; idx < count; idx++) {
+      bus_->send(address_, datagrams[idx].destination, datagrams[idx].data);
+    }
+    return count;
+  }
+
+  // The bus takes everything it is given
+  void async_wait_writable(write_handler handler) {
+    strand_.post([handler = std::move(handler)]() { handler(true); });
+  }
+
+  void send_now(const endpoint& destination, const packet& data) {
+    bus_->send(address_, destination, data);
+  }
+
+  std::optional<address_provider::address_list> addresses() const {
+    return address_provider::address_list{address_};
+  }
+
+  void close() { bus_->detach(address_); }
+
+ private:
+  void on_delivery_(const endpoint& sender, const packet& data) {
+    if (!handler_ || data->size() > max_datagram_size) {
+      return;
+    }
+
+    auto datagram = pool_.acquire();
+    std::memcpy(datagram->data, data->data(), data->size());
+    datagram->size = data->size();
+    datagram->sender = sender;
+    datagram->received = detail::clock::now();
+    io_ctx_.post([this, datagram = std::move(datagram)]() {
+      handler_(datagram);
+    });
+  }
+
+  boost::asio::io_context& io_ctx_;
+  boost::asio::io_context::strand& strand_;
+  datagram_pool& pool_;
+  bus* const bus_;
+  boost::asio::ip::address address_;
+  receive_handler handler_;
+};
+
+}  // namespace mmdns::net::sim
@@ -0,0 +1,317 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/asio.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "detail/mdns_log.hpp"
+#include "detail/metrics.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_builder.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "mdns_service_register.hpp"
+#include "mdns_service_responder.hpp"
+#include "mdns_service_scheduler.hpp"
+#include "net/net_steam.hpp"
+#include "test_data.hpp"
+
+using namespace mmdns;
+
+namespace {
+
+constexpr size_t max_packet_size = 1472;
+
+std::string instance_name(size_t idx) {
+  return "service" + std::to_string(idx) + "._bench._tcp.local";
+}
+
+service::descriptor make_descriptor(size_t idx) {
+  return service::descriptor{"service" + std::to_string(idx),
+                             "benchhost.local",
+                             "_bench._tcp",
+                             "local",
+                             static_cast<uint16_t>(7000 + idx % 1000),
+                             {{"path", "/bench"}, {"v", "1"}}};
+}
+
+// A registry with |count| services published, service0 to service<count-1>
+// of type _bench._tcp on one host. Registering goes through probing like it
+// would in the daemon, with the packets going nowhere, and takes a second
+// or so. Once done nothing runs on the registry any more.
+class populated_registry {
+ public:
+  explicit populated_registry(size_t count)
+      : worker_ctx_(), metrics_(), registry_(worker_ctx_, metrics_) {
+    registry_.set_send_handler([](service::registry::packet) {});
+
+    size_t done = 0;
+    for (size_t idx = 0; idx < count; idx++) {
+      registry_.register_service(
+          make_descriptor(idx),
+          [&done](bool, const service::descriptor&) { done++; });
+    }
+    while (done < count) {
+      worker_ctx_.run_one();
+    }
+  }
+
+  const service::registry& get() const { return registry_; }
+
+ private:
+  boost::asio::io_context worker_ctx_;
+  detail::metrics metrics_;
+  service::registry registry_;
+};
+
+// Built on first use and never destroyed: a registry sends goodbyes for its
+// services when it goes
+const service::registry& registry_with(size_t count) {
+  static auto* registries =
+      new std::map<size_t, std::unique_ptr<populated_registry>>();
+  auto& populated = (*registries)[count];
+  if (!populated) {
+    populated = std::make_unique<populated_registry>(count);
+  }
+  return populated->get();
+}
+
+// A query for |name|, with the unicast response bit set on every question
+std::vector<net::net_stream_data> make_query(
+    std::string_view name,
+    std::initializer_list<message::mdns_rr_type> types) {
+  std::vector<net::net_stream_data> packet(max_packet_size);
+  codec::compression_table names;
+  codec::mdns_message_encoder encoder{packet.data(), packet.size(), &names};
+  message::mdns_header_t header{};
+  encoder.encode_header(header);
+  for (auto type : types) {
+    encoder.encode_question(name, type, 0x8000 | 1);
+    header.question_count++;
+  }
+  codec::mdns_message_encoder{packet.data(), packet.size()}.encode_header(
+      header);
+  packet.resize(encoder.get_size());
+  return packet;
+}
+
+// in3 and in4 have PTR records with a data length short of their names, so
+// they time the decoder up to where it rejects them; "decoded" tells which
+// way a capture went
+void decode(benchmark::State& state, const uint8_t* data, size_t size) {
+  bool decoded = false;
+  for (auto _ : state) {
+    net::net_stream stream(data, size);
+    message::mdns_message_t message;
+    auto result = codec::mdns_message_decoder{message}.decode(stream);
+    decoded = static_cast<bool>(result);
+    benchmark::DoNotOptimize(result);
+    benchmark::DoNotOptimize(message);
+  }
+  state.SetBytesProcessed(state.iterations() * size);
+  state.counters["decoded"] = decoded;
+}
+BENCHMARK_CAPTURE(decode, in1, in1, sizeof(in1));
+BENCHMARK_CAPTURE(decode, in2, in2, sizeof(in2));
+BENCHMARK_CAPTURE(decode, in3, in3, sizeof(in3));
+BENCHMARK_CAPTURE(decode, in4, in4, sizeof(in4));
+BENCHMARK_CAPTURE(decode,
+                  dns_sd_advert_example,
+                  dns_sd_advert_example,
+                  sizeof(dns_sd_advert_example));
+
+// The response the registry lays out for a service when it is registered
+void build_registration_response(benchmark::State& state) {
+  using section = codec::mdns_message_builder::section;
+
+  codec::mdns_message_builder builder;
+  const auto service = make_descriptor(0);
+  const uint8_t v4[4] = {192, 0, 2, 1};
+  const uint8_t v6[16] = {0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+  for (auto _ : state) {
+    builder.reset();
+    auto instance =
+        builder.intern({service.name, service.type, service.domain});
+    auto type = builder.intern({service.type, service.domain});
+    auto service_types =
+        builder.intern({"_services._dns-sd._udp", service.domain});
+    auto host = builder.intern({service.host_name});
+    builder.add_txt(section::answer, *instance, 4500, true, service.data);
+    builder.add_ptr(section::answer, *service_types, 4500, false, *type);
+    builder.add_ptr(section::answer, *type, 4500, false, *instance);
+    builder.add_srv(section::answer, *instance, 120, true, 0, 0, service.port,
+                    *host);
+    builder.add_address(section::additional, *host, 120, true, v4,
+                        sizeof(v4));
+    builder.add_address(section::additional, *host, 120, true, v6,
+                        sizeof(v6));
+    auto response = builder.finish();
+    benchmark::DoNotOptimize(response);
+  }
+}
+BENCHMARK(build_registration_response);
+
+// Announcing a published service: its records encoded into one packet from
+// their wire format, names compressed, like the registry does it
+void encode_announcement(benchmark::State& state) {
+  const auto& registry = registry_with(10);
+  const auto instance = instance_name(0);
+  std::vector<std::shared_ptr<const service::record>> records;
+  auto collect = [&](const std::shared_ptr<const service::record>& rr) {
+    records.push_back(rr);
+  };
+  // The type and host records are shared by all ten services
+  registry.for_each_record(std::string_view("_services._dns-sd._udp.local"),
+                           message::PTR, collect);
+  registry.for_each_record(
+      std::string_view("_bench._tcp.local"), message::PTR,
+      [&](const std::shared_ptr<const service::record>& rr) {
+        if (message::dns_name_equals(rr->target, instance)) {
+          records.push_back(rr);
+        }
+      });
+  registry.for_each_record(instance, message::ANY, collect);
+  registry.for_each_record(std::string_view("benchhost.local"), message::ANY,
+                           collect);
+
+  std::vector<net::net_stream_data> packet(max_packet_size);
+  codec::compression_table names;
+  for (auto _ : state) {
+    names.clear();
+    codec::mdns_message_encoder encoder{packet.data(), packet.size(), &names};
+    message::mdns_header_t header{};
+    encoder.encode_header(header);
+    for (const auto& rr : records) {
+      encoder.encode_rr(rr->wire.data(), rr->wire.size(), rr->data_offset,
+                        rr->ttl);
+    }
+    benchmark::DoNotOptimize(encoder.get_size());
+    benchmark::ClobberMemory();
+  }
+  state.counters["records"] = records.size();
+}
+BENCHMARK(encode_announcement);
+
+void get_service_descriptor(benchmark::State& state) {
+  const size_t count = state.range(0);
+  const auto& registry = registry_with(count);
+
+  // Spread over the whole registry so that lookups don't all hit the cache
+  // lines of one entry
+  std::vector<std::string> names;
+  for (size_t idx = 0; idx < 1024; idx++) {
+    names.push_back(instance_name(idx * 7919 % count));
+  }
+
+  size_t next = 0;
+  for (auto _ : state) {
+    auto found = registry.get_service_descriptor(names[next++ % names.size()]);
+    benchmark::DoNotOptimize(found);
+  }
+}
+BENCHMARK(get_service_descriptor)->Arg(10)->Arg(1000)->Arg(100000);
+
+void get_service_descriptor_miss(benchmark::State& state) {
+  const auto& registry = registry_with(state.range(0));
+  const std::string name = "absent._bench._tcp.local";
+
+  for (auto _ : state) {
+    auto found = registry.get_service_descriptor(name);
+    benchmark::DoNotOptimize(found);
+  }
+}
+BENCHMARK(get_service_descriptor_miss)->Arg(10)->Arg(1000)->Arg(100000);
+
+// A PTR query for the service type, answered with every instance of it
+void respond_to_browse(benchmark::State& state) {
+  const service::responder responder{registry_with(state.range(0))};
+  const auto query = make_query("_bench._tcp.local", {message::PTR});
+
+  size_t answers = 0;
+  size_t additionals = 0;
+  for (auto _ : state) {
+    net::net_stream stream(query.data(), query.size());
+    message::mdns_message_t message;
+    codec::mdns_message_decoder{message}.decode(stream);
+    auto answer = responder.respond(message);
+    answers = answer.answers.size();
+    additionals = answer.additionals.size();
+    benchmark::DoNotOptimize(answer);
+  }
+  state.counters["answers"] = answers;
+  state.counters["additionals"] = additionals;
+}
+BENCHMARK(respond_to_browse)->Arg(10)->Arg(100)->Arg(1000);
+
+// From the bytes of an SRV and TXT query for one instance to the packets of
+// its response: decode, look the records up, schedule and encode. The
+// answers are unique records asked for by unicast, so the scheduler sends
+// them without delay.
+void query_to_response(benchmark::State& state) {
+  const size_t count = state.range(0);
+  const service::responder responder{registry_with(count)};
+
+  std::vector<std::vector<net::net_stream_data>> queries;
+  for (size_t idx = 0; idx < 64; idx++) {
+    queries.push_back(make_query(instance_name(idx * 7919 % count),
+                                 {message::SRV, message::TXT}));
+  }
+
+  boost::asio::io_context io_ctx;
+  boost::asio::io_context::strand strand(io_ctx);
+  size_t sent = 0;
+  size_t bytes = 0;
+  service::scheduler scheduler(
+      io_ctx, strand,
+      [&sent, &bytes](const service::scheduler::endpoint&,
+                      std::vector<service::scheduler::packet>&& packets,
+                      service::scheduler::clock::time_point) {
+        for (const auto& packet : packets) {
+          bytes += packet->size();
+        }
+        sent++;
+      });
+  const service::scheduler::endpoint destination(
+      boost::asio::ip::make_address("192.0.2.100"), 5353);
+
+  size_t next = 0;
+  for (auto _ : state) {
+    const auto& query = queries[next++ % queries.size()];
+    net::net_stream stream(query.data(), query.size());
+    message::mdns_message_t message;
+    codec::mdns_message_decoder{message}.decode(stream);
+
+    // Runs until the timer the response waits on has fired and sent it
+    scheduler.schedule(destination, responder.respond(message));
+    io_ctx.restart();
+    io_ctx.run();
+  }
+  if (sent != static_cast<size_t>(state.iterations())) {
+    state.SkipWithError("queries went unanswered");
+  }
+  state.counters["response_bytes"] =
+      benchmark::Counter(bytes, benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(query_to_response)->Arg(10)->Arg(1000)->Arg(100000);
+
+}  // namespace
+
+// Takes the usual Google Benchmark flags, e.g.
+//   mmdnsd_bench --benchmark_out=baseline.json --benchmark_out_format=json
+// for numbers to compare later runs against with compare.py
+int main(int argc, char** argv) {
+  // Registering a few thousand services would log every announcement
+  detail::set_log_level(detail::log_level::warning);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "mdns_record_cache.hpp"
+#include "mdns_service_browser.hpp"
+#include "net/net_steam.hpp"
+
+using namespace mmdns;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr const char* service_type = "_http._tcp.local";
+
+// A response on the link, with the buffer the names in |message| point into
+struct response {
+  std::shared_ptr<std::vector<net::net_stream_data>> data;
+  message::mdns_message_t message;
+};
+
+// A response with the PTR from |service_type| to |instance|, |ttl| 0 being a
+// goodbye
+response ptr_response(const std::string& instance, uint32_t ttl) {
+  constexpr uint16_t CLASS_IN = 1;
+  auto data = std::make_shared<std::vector<net::net_stream_data>>(512);
+  codec::mdns_message_encoder encoder{data->data(), data->size()};
+
+  message::mdns_header_t header{};
+  header.set_query(false);
+  header.answer_count = 1;
+  encoder.encode_header(header);
+  encoder.encode_name(std::string_view(service_type));
+  encoder.encode_u16(message::PTR);
+  encoder.encode_u16(CLASS_IN);
+  encoder.encode_u32(ttl);
+  encoder.encode_u16(static_cast<uint16_t>(instance.size() + 2));
+  encoder.encode_name(std::string_view(instance));
+
+  response built{data, {}};
+  net::net_stream stream(data->data(), encoder.get_size());
+  EXPECT_TRUE(codec::mdns_message_decoder{built.message}.decode(stream));
+  return built;
+}
+
+// A browser on an io_context run by hand, in virtual time
+class browser_test : public ::testing::Test {
+ protected:
+  browser_test()
+      : io_ctx_(),
+        strand_(io_ctx_),
+        cache_(),
+        browser_(io_ctx_, strand_, cache_,
+                 boost::asio::ip::udp::endpoint(
+                     boost::asio::ip::make_address("224.0.0.251"), 5353),
+                 [this](const auto&, auto&&) { queries_sent_++; }) {}
+
+  void SetUp() override {
+    detail::clock::simulate(detail::clock::time_point(std::chrono::hours(1)));
+    browser_.browse(
+        service_type,
+        [this](const std::string& name) { added_.push_back(name); },
+        [this](const std::string& name) { removed_.push_back(name); });
+    run_for(0ms);
+  }
+
+  void TearDown() override {
+    io_ctx_.poll();
+    detail::clock::stop_simulating();
+  }
+
+  void receive(const response& received) {
+    browser_.on_response(received.data, received.message);
+    run_for(0ms);
+  }
+
+  // Moves virtual time on a little at a time, running whatever is due
+  void run_for(detail::clock::duration duration) {
+    const auto end = detail::clock::now() + duration;
+    do {
+      detail::clock::advance_to(
+          std::min(end, detail::clock::now() + detail::clock::duration(10ms)));
+      if (io_ctx_.stopped()) {
+        io_ctx_.restart();
+      }
+      io_ctx_.poll();
+    } while (detail::clock::now() < end);
+  }
+
+  boost::asio::io_context io_ctx_;
+  boost::asio::io_context::strand strand_;
+  client::record_cache cache_;
+  client::browser browser_;
+  std::vector<std::string> added_;
+  std::vector<std::string> removed_;
+  size_t queries_sent_ = 0;
+};
+
+}  // namespace
+
+// A host leaving that we never saw arrive is not news
+TEST_F(browser_test, goodbye_for_unknown_instance) {
+  receive(ptr_response("gone._http._tcp.local", 0));
+  run_for(3s);
+
+  EXPECT_TRUE(added_.empty());
+  EXPECT_TRUE(removed_.empty());
+}
+
+// A goodbye for a known instance removes it a second later, RFC 6762 §10.1
+TEST_F(browser_test, goodbye_for_known_instance) {
+  receive(ptr_response("printer._http._tcp.local", 120));
+  ASSERT_EQ(added_, std::vector<std::string>{"printer._http._tcp.local"});
+
+  // Seen again, still the one instance
+  receive(ptr_response("Printer._http._tcp.local", 120));
+  EXPECT_EQ(added_.size(), 1u);
+
+  receive(ptr_response("printer._http._tcp.local", 0));
+  run_for(900ms);
+  EXPECT_TRUE(removed_.empty());
+
+  run_for(200ms);
+  EXPECT_EQ(removed_, std::vector<std::string>{"printer._http._tcp.local"});
+
+  // Once gone, a second goodbye is no news either
+  receive(ptr_response("printer._http._tcp.local", 0));
+  run_for(3s);
+  EXPECT_EQ(added_.size(), 1u);
+  EXPECT_EQ(removed_.size(), 1u);
+}
@@ -0,0 +1,304 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "net/net_steam.hpp"
+#include "test_data.hpp"
+
+using namespace mmdns;
+
+namespace {
+
+codec::decode_result decode(const uint8_t* data,
+                            size_t size,
+                            message::mdns_message_t& message) {
+  net::net_stream stream(data, size);
+  return codec::mdns_message_decoder{message}.decode(stream);
+}
+
+codec::decode_result decode(const std::vector<uint8_t>& data,
+                            message::mdns_message_t& message) {
+  return decode(data.data(), data.size(), message);
+}
+
+// A header with the given section counts and nothing else set
+std::vector<uint8_t> header(uint8_t questions, uint8_t answers = 0) {
+  return {0, 0, 0, 0, 0, questions, 0, answers, 0, 0, 0, 0};
+}
+
+void append(std::vector<uint8_t>& packet,
+            std::initializer_list<uint8_t> bytes) {
+  packet.insert(packet.end(), bytes);
+}
+
+// Type PTR, class IN
+void append_question_fields(std::vector<uint8_t>& packet) {
+  append(packet, {0, 12, 0, 1});
+}
+
+std::vector<std::pair<std::string, std::string>> txt_entries(
+    const message::mdns_rr_t& rr) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  rr.txt().for_each_entry([&entries](auto key, auto value) {
+    entries.emplace_back(key, value);
+  });
+  return entries;
+}
+
+}  // namespace
+
+// A browse for 21 service types, with the PTRs the querier already knows
+TEST(decoder, query_with_known_answers) {
+  message::mdns_message_t message;
+  auto result = decode(in1, sizeof(in1), message);
+  ASSERT_TRUE(result);
+  EXPECT_EQ(result.offset, sizeof(in1));
+
+  EXPECT_TRUE(message.header.is_query());
+  EXPECT_EQ(message.header.question_count, 21);
+  EXPECT_EQ(message.header.answer_count, 7);
+  ASSERT_EQ(message.queries.size(), 21u);
+  ASSERT_EQ(message.answers.size(), 7u);
+  EXPECT_TRUE(message.authorities.empty());
+  EXPECT_TRUE(message.additionals.empty());
+
+  for (const auto& query : message.queries) {
+    EXPECT_EQ(query.query_type, message::PTR);
+    EXPECT_EQ(query.query_class, 1);
+    EXPECT_FALSE(query.unicast_response);
+  }
+  EXPECT_EQ(message.queries[0].name.to_string(), "_airport._tcp.local");
+  EXPECT_EQ(message.queries[13].name.to_string(),
+            "922b0823._sub._apple-mobdev2._tcp.local");
+  EXPECT_EQ(message.queries[15].name.to_string(), "_sleep-proxy._udp.local");
+  EXPECT_EQ(message.queries[20].name.to_string(), "_sonos._tcp.local");
+  EXPECT_TRUE(message.queries[19].name.equals("_SERVICES._dns-sd._udp.local"));
+
+  const auto& first = message.answers[0];
+  EXPECT_EQ(first.name.to_string(), "_services._dns-sd._udp.local");
+  EXPECT_EQ(first.type, message::PTR);
+  EXPECT_FALSE(first.cache_flush);
+  EXPECT_EQ(first.ttl, 4461u);
+  EXPECT_EQ(first.ptr().name.to_string(), "_smb._tcp.local");
+
+  // Its data is nothing but a pointer
+  EXPECT_EQ(message.answers[4].data_length, 2);
+  EXPECT_EQ(message.answers[4].ptr().name.to_string(), "_sonos._tcp.local");
+
+  const auto& last = message.answers[6];
+  EXPECT_EQ(last.name.to_string(), "_sonos._tcp.local");
+  EXPECT_EQ(last.ptr().name.to_string(),
+            "Sonos-7828CA000650._sonos._tcp.local");
+}
+
+TEST(decoder, response_with_large_txt) {
+  message::mdns_message_t message;
+  ASSERT_TRUE(decode(in2, sizeof(in2), message));
+
+  EXPECT_FALSE(message.header.is_query());
+  EXPECT_TRUE(message.header.has_authorative());
+  EXPECT_TRUE(message.queries.empty());
+  ASSERT_EQ(message.answers.size(), 2u);
+
+  const auto& txt = message.answers[0];
+  EXPECT_EQ(txt.name.to_string(), "DanielSantos3._nomachine._tcp.local");
+  EXPECT_EQ(txt.type, message::TXT);
+  EXPECT_TRUE(txt.cache_flush);
+  EXPECT_EQ(txt.rr_class, 1);
+  EXPECT_EQ(txt.ttl, 600u);
+  EXPECT_EQ(txt.data_length, 409);
+
+  const auto entries = txt_entries(txt);
+  ASSERT_EQ(entries.size(), 9u);
+  EXPECT_EQ(entries[0], std::make_pair(std::string("name"),
+                                       std::string("DanielSantos3")));
+  EXPECT_EQ(entries[2],
+            std::make_pair(std::string("type"), std::string("NoMachine")));
+  EXPECT_EQ(entries[7],
+            std::make_pair(std::string("service"), std::string("nx:4000")));
+
+  const auto& ptr = message.answers[1];
+  EXPECT_EQ(ptr.name.to_string(), "_nomachine._tcp.local");
+  EXPECT_EQ(ptr.type, message::PTR);
+  EXPECT_EQ(ptr.ttl, 120u);
+  EXPECT_EQ(ptr.ptr().name.to_string(), "DanielSantos3._nomachine._tcp.local");
+}
+
+// in3 and in4 have a PTR record with a data length short of the name in it
+TEST(decoder, damaged_captures) {
+  for (auto [data, size] : {std::make_pair(in3, sizeof(in3)),
+                            std::make_pair(in4, sizeof(in4))}) {
+    message::mdns_message_t message;
+    auto result = decode(data, size, message);
+    EXPECT_FALSE(result);
+    EXPECT_EQ(result.error, codec::decode_error::bad_name);
+    EXPECT_EQ(result.offset, 485u);
+  }
+}
+
+TEST(decoder, service_advertisement) {
+  message::mdns_message_t message;
+  ASSERT_TRUE(decode(dns_sd_advert_example, sizeof(dns_sd_advert_example),
+                     message));
+
+  EXPECT_FALSE(message.header.is_query());
+  ASSERT_EQ(message.answers.size(), 4u);
+  ASSERT_EQ(message.additionals.size(), 4u);
+
+  const auto& txt = message.answers[0];
+  EXPECT_EQ(txt.name.to_string(), "mdnstest._mdnstest._tcp.local");
+  EXPECT_EQ(txt.type, message::TXT);
+  EXPECT_EQ(txt.ttl, 4500u);
+  EXPECT_EQ(txt_entries(txt),
+            (std::vector<std::pair<std::string, std::string>>{
+                {"test", "daniel"}}));
+
+  EXPECT_EQ(message.answers[1].ptr().name.to_string(), "_mdnstest._tcp.local");
+  EXPECT_EQ(message.answers[2].ptr().name.to_string(),
+            "mdnstest._mdnstest._tcp.local");
+
+  const auto& srv = message.answers[3];
+  EXPECT_EQ(srv.type, message::SRV);
+  EXPECT_TRUE(srv.cache_flush);
+  EXPECT_EQ(srv.ttl, 120u);
+  EXPECT_EQ(srv.srv().priority, 0);
+  EXPECT_EQ(srv.srv().weight, 0);
+  EXPECT_EQ(srv.srv().port, 56777);
+  EXPECT_EQ(srv.srv().target.to_string(), "Daniels-MacBook-Pro.local");
+
+  const auto& aaaa = message.additionals[0];
+  EXPECT_EQ(aaaa.name.to_string(), "Daniels-MacBook-Pro.local");
+  EXPECT_EQ(aaaa.type, message::AAAA);
+  EXPECT_EQ(aaaa.aaaa().address[0], 0xfe);
+  EXPECT_EQ(aaaa.aaaa().address[1], 0x80);
+  EXPECT_EQ(aaaa.aaaa().address[15], 0x33);
+
+  const auto& a = message.additionals[1];
+  EXPECT_EQ(a.type, message::A);
+  const uint8_t address[] = {192, 168, 1, 182};
+  EXPECT_TRUE(std::equal(std::begin(address), std::end(address),
+                         a.a().address));
+
+  // NSEC is kept as opaque data
+  EXPECT_EQ(message.additionals[2].type, 47);
+  EXPECT_EQ(message.additionals[2].data_length, 8);
+}
+
+TEST(decoder, pointer_to_itself) {
+  auto packet = header(1);
+  append(packet, {0xc0, 12});
+  append_question_fields(packet);
+
+  message::mdns_message_t message;
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::bad_name);
+  EXPECT_EQ(result.offset, 12u);
+}
+
+// Two names pointing at each other, the first pointer goes forwards
+TEST(decoder, pointer_loop) {
+  auto packet = header(2);
+  append(packet, {1, 'a', 0xc0, 18});
+  append_question_fields(packet);
+  append(packet, {1, 'b', 0xc0, 12});
+  append_question_fields(packet);
+
+  message::mdns_message_t message;
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::bad_name);
+  EXPECT_EQ(result.offset, 12u);
+}
+
+TEST(decoder, forward_pointer) {
+  auto packet = header(2);
+  append(packet, {0xc0, 18});
+  append_question_fields(packet);
+  append(packet, {1, 'a', 0});
+  append_question_fields(packet);
+
+  message::mdns_message_t message;
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::bad_name);
+  EXPECT_EQ(result.offset, 12u);
+}
+
+// Every question but the first points at the one before it, so the name of
+// question n takes n hops
+TEST(decoder, pointer_hop_limit) {
+  constexpr size_t hops = message::mdns_name_t::MAX_POINTER_HOPS;
+  auto chain = [](size_t questions) {
+    auto packet = header(static_cast<uint8_t>(questions));
+    append(packet, {1, 'a', 0});
+    append_question_fields(packet);
+    size_t previous = 12;
+    for (size_t idx = 1; idx < questions; idx++) {
+      const size_t start = packet.size();
+      append(packet, {0xc0, static_cast<uint8_t>(previous)});
+      append_question_fields(packet);
+      previous = start;
+    }
+    return packet;
+  };
+
+  const auto longest = chain(hops + 1);
+  message::mdns_message_t message;
+  ASSERT_TRUE(decode(longest, message));
+  EXPECT_EQ(message.queries[hops].name.to_string(), "a");
+
+  const auto packet = chain(hops + 2);
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::bad_name);
+  EXPECT_EQ(result.offset, packet.size() - 6);
+}
+
+TEST(decoder, truncated_rdata) {
+  // An A record with two of its four bytes
+  auto packet = header(0, 1);
+  append(packet, {0, 0, 1, 0, 1, 0, 0, 0, 120, 0, 4, 192, 168});
+
+  message::mdns_message_t message;
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::truncated_rr);
+  EXPECT_EQ(result.offset, 23u);
+}
+
+// A PTR whose target runs past its data length into the next record
+TEST(decoder, rdata_name_past_data_length) {
+  auto packet = header(0, 1);
+  append(packet, {0, 0, 12, 0, 1, 0, 0, 0, 120, 0, 2, 1, 'a', 0});
+
+  message::mdns_message_t message;
+  auto result = decode(packet, message);
+  EXPECT_EQ(result.error, codec::decode_error::bad_name);
+}
+
+TEST(net_stream, seek_within_what_was_read) {
+  const uint8_t data[] = {1, 2, 3, 4, 5, 6};
+  net::net_stream stream(data, sizeof(data));
+
+  auto [at_start, start] = stream.seek(0);
+  EXPECT_TRUE(at_start);
+  EXPECT_EQ(start, data);
+  EXPECT_FALSE(std::get<0>(stream.seek(1)));
+
+  ASSERT_TRUE(std::get<0>(stream.read(4)));
+  auto [back, second] = stream.seek(1);
+  EXPECT_TRUE(back);
+  EXPECT_EQ(second, data + 1);
+  auto [at_end, fourth] = stream.seek(4);
+  EXPECT_TRUE(at_end);
+  EXPECT_EQ(fourth, data + 4);
+
+  // Not yet read, or past the end
+  EXPECT_FALSE(std::get<0>(stream.seek(5)));
+  EXPECT_FALSE(std::get<0>(stream.seek(sizeof(data) + 1)));
+
+  EXPECT_FALSE(std::get<0>(stream.read(3)));
+  EXPECT_EQ(stream.get_bytes_read(), 4u);
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "net/net_steam.hpp"
+
+using namespace mmdns;
+
+namespace {
+
+constexpr uint16_t CLASS_IN = 1;
+
+// Compresses names into a packet of its own, one question at a time
+class packet_writer {
+ public:
+  explicit packet_writer(size_t capacity = 4096)
+      : data_(capacity), names_(), encoder_(data_.data(), capacity, &names_) {
+    encoder_.encode_header({});
+  }
+
+  // The bytes the name of the question took
+  size_t question(const std::string& name) {
+    const size_t start = encoder_.get_size();
+    EXPECT_TRUE(encoder_.encode_question(name, message::PTR, CLASS_IN));
+    questions_++;
+    return encoder_.get_size() - start - 4;
+  }
+
+  codec::mdns_message_encoder& encoder() { return encoder_; }
+
+  // Decodes what was written, with the counts filled in
+  bool decode(message::mdns_message_t& message, uint16_t answers = 0) {
+    message::mdns_header_t header{};
+    header.question_count = questions_;
+    header.answer_count = answers;
+    codec::mdns_message_encoder{data_.data(), data_.size()}.encode_header(
+        header);
+
+    net::net_stream stream(data_.data(), encoder_.get_size());
+    return bool(codec::mdns_message_decoder{message}.decode(stream));
+  }
+
+  void forget_questions(uint16_t count) { questions_ -= count; }
+
+ private:
+  std::vector<net::net_stream_data> data_;
+  codec::compression_table names_;
+  codec::mdns_message_encoder encoder_;
+  uint16_t questions_ = 0;
+};
+
+// A name on the wire: one byte of size per label, labels, root
+size_t uncompressed_size(const std::string& name) {
+  return name.size() + 2;
+}
+
+}  // namespace
+
+TEST(compression, round_trip) {
+  const std::vector<std::string> names = {
+      "_http._tcp.local", "printer._http._tcp.local",
+      "scanner._http._tcp.local", "host.local", "_ipp._tcp.local",
+      "Printer._http._tcp.local"};
+
+  packet_writer packet;
+  std::vector<size_t> sizes;
+  for (const auto& name : names) {
+    sizes.push_back(packet.question(name));
+  }
+
+  // The first in full, the rest up to the suffix already there
+  EXPECT_EQ(sizes[0], uncompressed_size(names[0]));
+  EXPECT_EQ(sizes[1], 1 + 7 + 2);
+  EXPECT_EQ(sizes[2], 1 + 7 + 2);
+  EXPECT_EQ(sizes[3], 1 + 4 + 2);
+  EXPECT_EQ(sizes[4], 1 + 4 + 2);
+  // Suffixes are matched byte for byte, so only "_http._tcp.local" is shared
+  EXPECT_EQ(sizes[5], 1 + 7 + 2);
+
+  message::mdns_message_t message;
+  ASSERT_TRUE(packet.decode(message));
+  ASSERT_EQ(message.queries.size(), names.size());
+  for (size_t idx = 0; idx < names.size(); idx++) {
+    EXPECT_EQ(message.queries[idx].name.to_string(), names[idx]);
+  }
+}
+
+// Names in the data of a copied RR are compressed against those before it
+TEST(compression, round_trip_record) {
+  std::vector<net::net_stream_data> wire(256);
+  codec::mdns_message_encoder plain{wire.data(), wire.size()};
+  ASSERT_TRUE(plain.encode_name(std::string_view("_http._tcp.local")));
+  const auto data_offset = static_cast<uint16_t>(plain.get_size() + 10);
+  ASSERT_TRUE(plain.encode_u16(message::PTR) && plain.encode_u16(CLASS_IN) &&
+              plain.encode_u32(4500) && plain.encode_u16(26) &&
+              plain.encode_name(std::string_view("printer._http._tcp.local")));
+
+  packet_writer packet;
+  packet.question("_http._tcp.local");
+  const size_t start = packet.encoder().get_size();
+  ASSERT_TRUE(
+      packet.encoder().encode_rr(wire.data(), plain.get_size(), data_offset,
+                                 120));
+  // Pointer, fixed fields, then "printer" and a pointer
+  EXPECT_EQ(packet.encoder().get_size() - start, 2 + 10 + 1 + 7 + 2);
+
+  message::mdns_message_t message;
+  ASSERT_TRUE(packet.decode(message, 1));
+  ASSERT_EQ(message.answers.size(), 1u);
+  const auto& rr = message.answers[0];
+  EXPECT_EQ(rr.name.to_string(), "_http._tcp.local");
+  EXPECT_EQ(rr.type, message::PTR);
+  EXPECT_EQ(rr.ttl, 120u);
+  EXPECT_EQ(rr.ptr().name.to_string(), "printer._http._tcp.local");
+}
+
+// Once the table is full names are written out and not remembered, those
+// remembered before still compress
+TEST(compression, table_full) {
+  packet_writer packet;
+  // "local" and then one suffix a name
+  constexpr size_t remembered = 127;
+  for (size_t idx = 0; idx < remembered + 3; idx++) {
+    packet.question("n" + std::to_string(idx) + ".local");
+  }
+
+  EXPECT_EQ(packet.question("n5.local"), 2u);
+  EXPECT_EQ(packet.question("n126.local"), 2u);
+  // Only "local" is left to point at
+  EXPECT_EQ(packet.question("n127.local"), 1 + 4 + 2u);
+  EXPECT_EQ(packet.question("n129.local"), 1 + 4 + 2u);
+
+  message::mdns_message_t message;
+  ASSERT_TRUE(packet.decode(message));
+  EXPECT_EQ(message.queries.back().name.to_string(), "n129.local");
+  EXPECT_EQ(message.queries[remembered + 3].name.to_string(), "n5.local");
+}
+
+// Rewinding forgets the names past the new end, which makes room in a full
+// table and keeps later names from pointing at bytes that are gone
+TEST(compression, truncate) {
+  packet_writer packet;
+  constexpr size_t remembered = 127;
+  size_t rewind_to = 0;
+  for (size_t idx = 0; idx < remembered; idx++) {
+    if (idx == remembered - 10) {
+      rewind_to = packet.encoder().get_size();
+    }
+    packet.question("n" + std::to_string(idx) + ".local");
+  }
+
+  packet.encoder().rewind(rewind_to);
+  packet.forget_questions(10);
+
+  EXPECT_EQ(packet.question("other.local"), 1 + 5 + 2u);
+  EXPECT_EQ(packet.question("other.local"), 2u);
+  // Written over, so nothing to point at
+  EXPECT_EQ(packet.question("n120.local"), 1 + 4 + 2u);
+  EXPECT_EQ(packet.question("n0.local"), 2u);
+
+  message::mdns_message_t message;
+  ASSERT_TRUE(packet.decode(message));
+  ASSERT_EQ(message.queries.size(), remembered - 10 + 4);
+  EXPECT_EQ(message.queries[remembered - 10].name.to_string(), "other.local");
+  EXPECT_EQ(message.queries[remembered - 8].name.to_string(), "n120.local");
+  EXPECT_EQ(message.queries.back().name.to_string(), "n0.local");
+}
+
+// A question that doesn't fit leaves neither bytes nor names behind
+TEST(compression, failed_question) {
+  const std::string name = "printer._http._tcp.local";
+  // Room for the header and the name, not for the type and class
+  packet_writer packet(12 + uncompressed_size(name) + 2);
+  const size_t start = packet.encoder().get_size();
+  EXPECT_FALSE(packet.encoder().encode_question(name, message::PTR, CLASS_IN));
+  EXPECT_EQ(packet.encoder().get_size(), start);
+
+  EXPECT_EQ(packet.question("local"), uncompressed_size("local"));
+
+  message::mdns_message_t message;
+  ASSERT_TRUE(packet.decode(message));
+  EXPECT_EQ(message.queries[0].name.to_string(), "local");
+}
@@ -0,0 +1,61 @@
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "net/net_steam.hpp"
+
+using namespace mmdns;
+
+// Decodes whatever the fuzzer comes up with and walks every name and TXT
+// string in it. What decodes has to encode back, uncompressed, into a packet
+// that decodes too.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  net::net_stream stream(data, size);
+  message::mdns_message_t message;
+  if (!codec::mdns_message_decoder{message}.decode(stream)) {
+    return 0;
+  }
+
+  for (const auto& query : message.queries) {
+    query.name.hash();
+    query.name.to_string();
+  }
+
+  std::vector<net::net_stream_data> packet(65535);
+  message::mdns_header_t header{};
+  codec::mdns_message_encoder encoder{packet.data(), packet.size()};
+  encoder.encode_header(header);
+
+  for (const auto* section :
+       {&message.answers, &message.authorities, &message.additionals}) {
+    for (const auto& rr : *section) {
+      rr.name.hash();
+      rr.name.to_string();
+      if (rr.type == message::TXT) {
+        rr.txt().for_each_entry([](auto key, auto value) {});
+      }
+      if (!encoder.encode_rr(rr)) {
+        // Names expand, running out of room is the one excuse
+        if (packet.size() - encoder.get_size() > 256 + 10 + 256 + 6 +
+                                                     rr.data_length) {
+          abort();
+        }
+        return 0;
+      }
+      header.answer_count++;
+    }
+  }
+
+  codec::mdns_message_encoder{packet.data(), packet.size()}.encode_header(
+      header);
+  net::net_stream reencoded(packet.data(), encoder.get_size());
+  message::mdns_message_t decoded;
+  if (!codec::mdns_message_decoder{decoded}.decode(reencoded) ||
+      decoded.answers.size() != header.answer_count) {
+    abort();
+  }
+  return 0;
+}
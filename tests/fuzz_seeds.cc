@@ -0,0 +1,27 @@
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include "test_data.hpp"
+
+// Writes the captured packets to the directory in argv[1], as the corpus the
+// fuzzer starts from
+int main(int argc, char** argv) {
+  if (argc != 2) {
+    return 1;
+  }
+
+  const std::string corpus = argv[1];
+  std::filesystem::create_directories(corpus);
+  auto write = [&corpus](const char* name, const uint8_t* data, size_t size) {
+    std::ofstream out(corpus + "/" + name, std::ios::binary);
+    out.write(reinterpret_cast<const char*>(data), size);
+    return out.good();
+  };
+
+  bool written = write("in1", in1, sizeof(in1)) &&
+                 write("in2", in2, sizeof(in2)) &&
+                 write("in3", in3, sizeof(in3)) &&
+                 write("in4", in4, sizeof(in4));
+  return written ? 0 : 1;
+}
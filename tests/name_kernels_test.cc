@@ -0,0 +1,228 @@
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "detail/name_kernels.hpp"
+
+// Built once per kernel, see meson.build: every build checks its own kernel
+// against the byte at a time versions below
+
+using namespace mmdns;
+
+namespace {
+
+constexpr size_t max_size = 255;
+
+char fold_byte(char value) {
+  return value >= 'A' && value <= 'Z' ? value | 0x20 : value;
+}
+
+std::string scalar_fold(const char* data, size_t size) {
+  std::string folded(data, size);
+  for (auto& value : folded) {
+    value = fold_byte(value);
+  }
+  return folded;
+}
+
+bool scalar_equals(const char* lhs, const char* rhs, size_t size) {
+  return scalar_fold(lhs, size) == scalar_fold(rhs, size);
+}
+
+// Folded, zero padded to whole 8 byte words, one round a word
+uint64_t scalar_hash(uint64_t hash, const char* data, size_t size) {
+  constexpr uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+  auto folded = scalar_fold(data, size);
+  folded.resize((size + 7) / 8 * 8, '\0');
+  for (size_t offset = 0; offset < folded.size(); offset += 8) {
+    uint64_t word;
+    std::memcpy(&word, folded.data() + offset, sizeof(word));
+    hash = (hash ^ word) * multiplier;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+// Mostly letters of either case, with every other byte value thrown in,
+// those with the top bit set and those a bit away from a letter included
+std::string random_label(std::mt19937& gen, size_t size) {
+  std::uniform_int_distribution<int> pick(0, 3);
+  std::uniform_int_distribution<int> letter(0, 25);
+  std::uniform_int_distribution<int> any(0, 255);
+  std::string label(size, '\0');
+  for (auto& value : label) {
+    switch (pick(gen)) {
+      case 0:
+        value = static_cast<char>('A' + letter(gen));
+        break;
+      case 1:
+        value = static_cast<char>('a' + letter(gen));
+        break;
+      default:
+        value = static_cast<char>(any(gen));
+        break;
+    }
+  }
+  return label;
+}
+
+std::string swap_case(std::string label) {
+  for (auto& value : label) {
+    if ((value >= 'A' && value <= 'Z') || (value >= 'a' && value <= 'z')) {
+      value ^= 0x20;
+    }
+  }
+  return label;
+}
+
+void check_fold(const char* data, size_t size) {
+  std::string out(size, '\0');
+  detail::fold_case(data, size, out.data());
+  EXPECT_EQ(out, scalar_fold(data, size)) << "size " << size;
+}
+
+void check_equals(const char* lhs, const char* rhs, size_t size) {
+  EXPECT_EQ(detail::equals_ignore_case(lhs, rhs, size),
+            scalar_equals(lhs, rhs, size))
+      << "size " << size;
+}
+
+void check_hash(const char* data, size_t size) {
+  EXPECT_EQ(detail::hash_ignore_case(42, data, size),
+            scalar_hash(42, data, size))
+      << "size " << size;
+}
+
+// Two pages, the second one unreadable: whatever reads past the end of the
+// first faults
+class guarded_page {
+ public:
+  guarded_page() : page_size_(sysconf(_SC_PAGESIZE)) {
+    auto* mapped = mmap(nullptr, 2 * page_size_, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped != MAP_FAILED) {
+      base_ = static_cast<char*>(mapped);
+      mprotect(base_ + page_size_, page_size_, PROT_NONE);
+    }
+  }
+
+  ~guarded_page() {
+    if (base_ != nullptr) {
+      munmap(base_, 2 * page_size_);
+    }
+  }
+
+  bool ok() const { return base_ != nullptr; }
+
+  // |data| copied so that it ends right at the guard
+  const char* at_end(const std::string& data) {
+    char* start = base_ + page_size_ - data.size();
+    std::memcpy(start, data.data(), data.size());
+    return start;
+  }
+
+ private:
+  const size_t page_size_;
+  char* base_ = nullptr;
+};
+
+// The AVX2 build may end up on a host without it
+class name_kernels : public ::testing::Test {
+ protected:
+  void SetUp() override {
+#if defined(MMDNS_NAME_KERNELS_AVX2)
+    if (!__builtin_cpu_supports("avx2")) {
+      GTEST_SKIP() << "no AVX2 on this host";
+    }
+#endif
+  }
+};
+
+}  // namespace
+
+TEST_F(name_kernels, fold_matches_scalar) {
+  std::mt19937 gen(1);
+  for (size_t size = 0; size <= max_size; size++) {
+    const auto label = random_label(gen, size);
+    check_fold(label.data(), size);
+
+    // In place
+    auto copy = label;
+    detail::fold_case(copy.data(), size, copy.data());
+    EXPECT_EQ(copy, scalar_fold(label.data(), size)) << "size " << size;
+  }
+}
+
+TEST_F(name_kernels, fold_every_byte_value) {
+  std::string all(256, '\0');
+  for (size_t idx = 0; idx < all.size(); idx++) {
+    all[idx] = static_cast<char>(idx);
+  }
+
+  // From every offset, so every byte value lands on every lane
+  for (size_t offset = 0; offset < 64; offset++) {
+    std::string rotated = all.substr(offset) + all.substr(0, offset);
+    check_fold(rotated.data(), rotated.size());
+  }
+}
+
+TEST_F(name_kernels, equals_matches_scalar) {
+  std::mt19937 gen(2);
+  for (size_t size = 0; size <= max_size; size++) {
+    const auto label = random_label(gen, size);
+    const auto swapped = swap_case(label);
+    check_equals(label.data(), swapped.data(), size);
+
+    // A difference anywhere, including those folding would hide for a
+    // letter but not for the bytes around the letters
+    for (size_t at = 0; at < size; at++) {
+      for (char flip : {'\x01', '\x20', '\x80'}) {
+        auto other = swapped;
+        other[at] ^= flip;
+        check_equals(label.data(), other.data(), size);
+      }
+    }
+  }
+}
+
+TEST_F(name_kernels, hash_matches_scalar) {
+  std::mt19937 gen(3);
+  for (size_t size = 0; size <= max_size; size++) {
+    const auto label = random_label(gen, size);
+    check_hash(label.data(), size);
+    EXPECT_EQ(detail::hash_ignore_case(7, label.data(), size),
+              detail::hash_ignore_case(7, swap_case(label).data(), size))
+        << "size " << size;
+  }
+}
+
+// load_partial() reads a whole block when that stays on the page; labels
+// ending right before an unreadable page have to go through the copy
+TEST_F(name_kernels, labels_ending_at_a_page_boundary) {
+  guarded_page lhs_page;
+  guarded_page rhs_page;
+  ASSERT_TRUE(lhs_page.ok() && rhs_page.ok());
+
+  std::mt19937 gen(4);
+  for (size_t size = 0; size <= max_size; size++) {
+    const auto label = random_label(gen, size);
+    const char* lhs = lhs_page.at_end(label);
+    const char* rhs = rhs_page.at_end(swap_case(label));
+
+    check_fold(lhs, size);
+    check_hash(lhs, size);
+    check_equals(lhs, rhs, size);
+
+    if (size > 0) {
+      auto other = swap_case(label);
+      other.back() ^= 0x01;
+      check_equals(lhs, rhs_page.at_end(other), size);
+    }
+  }
+}
@@ -0,0 +1,188 @@
+#include <gtest/gtest.h>
+
+#include <boost/asio.hpp>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_message_encoder.hpp"
+#include "mdns_record_cache.hpp"
+#include "mdns_service_resolver.hpp"
+#include "net/net_steam.hpp"
+
+using namespace mmdns;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr const char* instance_name = "printer._http._tcp.local";
+
+// A response on the link, with the buffer the names in |message| point into
+struct response {
+  std::shared_ptr<std::vector<net::net_stream_data>> data;
+  message::mdns_message_t message;
+};
+
+// A response with the SRV or the TXT of |instance_name|, or both
+response service_response(bool with_srv, bool with_txt) {
+  constexpr uint16_t CLASS_IN = 1;
+  const std::string host = "printer.local";
+  const std::string txt = "path=/queue";
+
+  auto data = std::make_shared<std::vector<net::net_stream_data>>(512);
+  codec::mdns_message_encoder encoder{data->data(), data->size()};
+
+  message::mdns_header_t header{};
+  header.set_query(false);
+  header.answer_count = with_srv + with_txt;
+  encoder.encode_header(header);
+  if (with_srv) {
+    encoder.encode_name(std::string_view(instance_name));
+    encoder.encode_u16(message::SRV);
+    encoder.encode_u16(CLASS_IN);
+    encoder.encode_u32(120);
+    encoder.encode_u16(static_cast<uint16_t>(6 + host.size() + 2));
+    encoder.encode_u16(0);
+    encoder.encode_u16(0);
+    encoder.encode_u16(631);
+    encoder.encode_name(std::string_view(host));
+  }
+  if (with_txt) {
+    encoder.encode_name(std::string_view(instance_name));
+    encoder.encode_u16(message::TXT);
+    encoder.encode_u16(CLASS_IN);
+    encoder.encode_u32(4500);
+    encoder.encode_u16(static_cast<uint16_t>(1 + txt.size()));
+    const net::net_stream_data size = static_cast<uint8_t>(txt.size());
+    encoder.encode_bytes(&size, 1);
+    encoder.encode_bytes(
+        reinterpret_cast<net::const_net_stream_pointer>(txt.data()),
+        txt.size());
+  }
+
+  response built{data, {}};
+  net::net_stream stream(data->data(), encoder.get_size());
+  EXPECT_TRUE(codec::mdns_message_decoder{built.message}.decode(stream));
+  return built;
+}
+
+// A resolver on an io_context run by hand, in virtual time
+class resolver_test : public ::testing::Test {
+ protected:
+  resolver_test()
+      : io_ctx_(),
+        strand_(io_ctx_),
+        cache_(),
+        resolver_(io_ctx_, strand_, cache_,
+                  boost::asio::ip::udp::endpoint(
+                      boost::asio::ip::make_address("224.0.0.251"), 5353),
+                  [this](const auto&, auto&&) { queries_sent_++; }) {}
+
+  void SetUp() override {
+    detail::clock::simulate(detail::clock::time_point(std::chrono::hours(1)));
+  }
+
+  void TearDown() override {
+    io_ctx_.poll();
+    detail::clock::stop_simulating();
+  }
+
+  void resolve() {
+    resolver_.resolve(instance_name,
+                      [this](bool found, const client::service_info& info) {
+                        results_.push_back(found);
+                        info_ = info;
+                      });
+    run_for(0ms);
+  }
+
+  // Cached the way the client does it, and then passed on
+  void receive(const response& received) {
+    cache_.insert(received.message);
+    resolver_.on_response(received.data, received.message);
+    run_for(0ms);
+  }
+
+  // Moves virtual time on a little at a time, running whatever is due
+  void run_for(detail::clock::duration duration) {
+    const auto end = detail::clock::now() + duration;
+    do {
+      detail::clock::advance_to(
+          std::min(end, detail::clock::now() + detail::clock::duration(10ms)));
+      if (io_ctx_.stopped()) {
+        io_ctx_.restart();
+      }
+      io_ctx_.poll();
+    } while (detail::clock::now() < end);
+  }
+
+  boost::asio::io_context io_ctx_;
+  boost::asio::io_context::strand strand_;
+  client::record_cache cache_;
+  client::resolver resolver_;
+  std::vector<bool> results_;
+  client::service_info info_;
+  size_t queries_sent_ = 0;
+};
+
+}  // namespace
+
+// An SRV on its own leaves the lookup waiting for the TXT
+TEST_F(resolver_test, waits_for_srv_and_txt) {
+  resolve();
+  EXPECT_EQ(queries_sent_, 1u);
+
+  receive(service_response(true, false));
+  EXPECT_TRUE(results_.empty());
+  EXPECT_TRUE(resolver_.is_resolving());
+
+  // Still asking
+  run_for(1s);
+  EXPECT_EQ(queries_sent_, 2u);
+
+  receive(service_response(false, true));
+  ASSERT_EQ(results_, std::vector<bool>{true});
+  EXPECT_EQ(info_.host_name, "printer.local");
+  EXPECT_EQ(info_.port, 631);
+  ASSERT_EQ(info_.data.size(), 1u);
+  EXPECT_EQ(info_.data[0].first, "path");
+  EXPECT_EQ(info_.data[0].second, "/queue");
+  EXPECT_FALSE(resolver_.is_resolving());
+}
+
+// Answered from the cache only once both are there
+TEST_F(resolver_test, answers_from_cache) {
+  cache_.insert(service_response(true, false).message);
+  resolve();
+  EXPECT_EQ(queries_sent_, 1u);
+  EXPECT_TRUE(results_.empty());
+
+  run_for(10s);
+  EXPECT_EQ(results_, std::vector<bool>{false});
+
+  cache_.insert(service_response(false, true).message);
+  resolve();
+  EXPECT_EQ(results_, (std::vector<bool>{false, true}));
+  EXPECT_EQ(queries_sent_, 3u);
+}
+
+// A response cached but never passed on, as when it comes in before the lookup
+// is pending, is found on the next retry
+TEST_F(resolver_test, retry_finds_missed_response) {
+  resolve();
+  EXPECT_EQ(queries_sent_, 1u);
+
+  cache_.insert(service_response(true, true).message);
+  run_for(900ms);
+  EXPECT_TRUE(results_.empty());
+
+  run_for(200ms);
+  EXPECT_EQ(results_, std::vector<bool>{true});
+  EXPECT_EQ(info_.port, 631);
+  EXPECT_EQ(queries_sent_, 1u);
+  EXPECT_FALSE(resolver_.is_resolving());
+}
@@ -0,0 +1,219 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "detail/timer_wheel.hpp"
+
+using namespace mmdns;
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr uint64_t level_span(size_t level) {
+  return uint64_t{1} << (6 * level);
+}
+
+struct task : detail::timer_node {
+  explicit task(int task_id) : id(task_id) {}
+  int id;
+};
+
+// Owns a wheel the way the registry does: ticks of 10 ms counted from an
+// epoch of detail::clock, which runs in virtual time here
+class timer_wheel_test : public ::testing::Test {
+ protected:
+  static constexpr detail::clock::duration tick = 10ms;
+
+  struct expiry {
+    int id;
+    uint64_t tick;
+    detail::clock::time_point at;
+  };
+
+  void SetUp() override { detail::clock::simulate(epoch_); }
+  void TearDown() override { detail::clock::stop_simulating(); }
+
+  uint64_t now_tick() const { return (detail::clock::now() - epoch_) / tick; }
+
+  detail::clock::time_point time_of(uint64_t at) const {
+    return epoch_ + at * tick;
+  }
+
+  // Moves virtual time on to |until|, stopping at every tick the wheel asks
+  // to be woken at on the way, like the registry's one asio timer
+  void run_until(uint64_t until) {
+    for (;;) {
+      wheel_.advance(now_tick(), [this](detail::timer_node& node) {
+        fired_.push_back(
+            {static_cast<task&>(node).id, wheel_.now(), detail::clock::now()});
+      });
+      wakeups_++;
+
+      uint64_t next;
+      if (now_tick() >= until || !wheel_.next_expiry(next) || next > until) {
+        break;
+      }
+      detail::clock::advance_to(time_of(next));
+    }
+
+    detail::clock::advance_to(time_of(until));
+    wheel_.advance(now_tick(), [this](detail::timer_node& node) {
+      fired_.push_back(
+          {static_cast<task&>(node).id, wheel_.now(), detail::clock::now()});
+    });
+  }
+
+  const detail::clock::time_point epoch_ =
+      detail::clock::time_point(std::chrono::hours(1));
+  detail::timer_wheel wheel_;
+  std::vector<expiry> fired_;
+  size_t wakeups_ = 0;
+};
+
+}  // namespace
+
+// Deadlines on every level, and either side of where one level hands over to
+// the next, all expire on their tick and in order
+TEST_F(timer_wheel_test, cascades_between_levels) {
+  const std::vector<uint64_t> deadlines = {
+      1,
+      level_span(1) - 1,
+      level_span(1),
+      level_span(1) + 1,
+      level_span(2) - 1,
+      level_span(2),
+      level_span(2) + level_span(1) + 7,
+      level_span(3) - 1,
+      level_span(3),
+      level_span(3) + 3 * level_span(2) + 5 * level_span(1) + 9,
+  };
+
+  std::vector<std::unique_ptr<task>> tasks;
+  // Scheduled last first, so the order they expire in is the wheel's doing
+  for (size_t idx = deadlines.size(); idx-- > 0;) {
+    tasks.push_back(std::make_unique<task>(static_cast<int>(idx)));
+    wheel_.schedule(*tasks.back(), deadlines[idx]);
+  }
+
+  run_until(level_span(4) - 1);
+
+  ASSERT_EQ(fired_.size(), deadlines.size());
+  for (size_t idx = 0; idx < deadlines.size(); idx++) {
+    EXPECT_EQ(fired_[idx].id, static_cast<int>(idx));
+    EXPECT_EQ(fired_[idx].tick, deadlines[idx]);
+    EXPECT_EQ(fired_[idx].at, time_of(deadlines[idx]));
+  }
+  for (const auto& scheduled : tasks) {
+    EXPECT_FALSE(scheduled->is_linked());
+  }
+}
+
+// A deadline set once the wheel has moved on is relative to nothing but the
+// tick it names
+TEST_F(timer_wheel_test, schedules_from_the_current_tick) {
+  run_until(100);
+  EXPECT_EQ(wheel_.now(), 100u);
+
+  task crossing(1);
+  task later(2);
+  task past(3);
+  wheel_.schedule(crossing, 170);
+  wheel_.schedule(later, 100 + level_span(2));
+  // Already past, so on the next tick
+  wheel_.schedule(past, 50);
+
+  run_until(100 + level_span(2));
+  ASSERT_EQ(fired_.size(), 3u);
+  EXPECT_EQ(fired_[0].id, 3);
+  EXPECT_EQ(fired_[0].tick, 101u);
+  EXPECT_EQ(fired_[1].id, 1);
+  EXPECT_EQ(fired_[1].tick, 170u);
+  EXPECT_EQ(fired_[2].id, 2);
+  EXPECT_EQ(fired_[2].tick, 100 + level_span(2));
+}
+
+// A node destroyed before it expires is just gone, wherever it is on the
+// wheel, and the nodes sharing its slot still expire
+TEST_F(timer_wheel_test, cancels_on_destruction) {
+  task first(1);
+  auto cancelled = std::make_unique<task>(2);
+  task last(3);
+  auto cascaded = std::make_unique<task>(4);
+  const uint64_t deadline = level_span(2) + 5;
+  wheel_.schedule(first, deadline);
+  wheel_.schedule(*cancelled, deadline);
+  wheel_.schedule(last, deadline);
+  wheel_.schedule(*cascaded, deadline + 10);
+
+  cancelled.reset();
+
+  // Past the cascade that moved them all down to the first level
+  run_until(level_span(2) + 1);
+  EXPECT_TRUE(fired_.empty());
+  EXPECT_TRUE(cascaded->is_linked());
+  cascaded.reset();
+
+  run_until(level_span(3));
+  ASSERT_EQ(fired_.size(), 2u);
+  EXPECT_EQ(fired_[0].id, 1);
+  EXPECT_EQ(fired_[1].id, 3);
+  EXPECT_EQ(fired_[0].tick, deadline);
+  EXPECT_EQ(fired_[1].tick, deadline);
+}
+
+// The wheel may be destroyed with nodes still on it, and they off it
+TEST_F(timer_wheel_test, outlives_and_is_outlived) {
+  task outlived(1);
+  {
+    detail::timer_wheel wheel;
+    wheel.schedule(outlived, 10);
+    auto gone = std::make_unique<task>(2);
+    wheel.schedule(*gone, 10);
+  }
+  EXPECT_FALSE(outlived.is_linked());
+}
+
+// Past the 2^24 ticks the wheel spans, about two days at 10 ms a tick, a node
+// waits on the last level until its deadline comes within range
+TEST_F(timer_wheel_test, far_future_deadlines) {
+  const uint64_t span = level_span(4);
+  task near_edge(1);
+  task beyond(2);
+  task far(3);
+  wheel_.schedule(near_edge, span - 1);
+  wheel_.schedule(beyond, span + 1000);
+  wheel_.schedule(far, 3 * span + 77);
+
+  run_until(3 * span + 100);
+
+  ASSERT_EQ(fired_.size(), 3u);
+  EXPECT_EQ(fired_[0].tick, span - 1);
+  EXPECT_EQ(fired_[1].tick, span + 1000);
+  EXPECT_EQ(fired_[2].tick, 3 * span + 77);
+  EXPECT_EQ(fired_[2].at, time_of(3 * span + 77));
+
+  // Skipping the empty stretches, not walking them tick by tick
+  EXPECT_LT(wakeups_, 1000u);
+}
+
+// A handler may put the node that expired straight back on the wheel
+TEST_F(timer_wheel_test, reschedules_from_the_handler) {
+  task periodic(1);
+  wheel_.schedule(periodic, 30);
+
+  std::vector<uint64_t> ticks;
+  for (uint64_t until = 30; ticks.size() < 5; until += 30) {
+    detail::clock::advance_to(time_of(until));
+    wheel_.advance(now_tick(), [&](detail::timer_node& node) {
+      ticks.push_back(wheel_.now());
+      wheel_.schedule(node, wheel_.now() + 30);
+    });
+  }
+
+  EXPECT_EQ(ticks, (std::vector<uint64_t>{30, 60, 90, 120, 150}));
+  EXPECT_TRUE(periodic.is_linked());
+}
@@ -0,0 +1,521 @@
+// Drives an in-process mdns_client with a mix of queries at a fixed packet
+// rate and reports how many it answered, how many it dropped and how long the
+// answers took. Everything goes over the multicast group on the local host,
+// so it needs no network beyond a multicast route. In a network namespace of
+// its own, e.g. on a CI runner:
+//
+//   unshare -rn sh -c 'ip link set lo up multicast on &&
+//                      ip route add 224.0.0.0/4 dev lo &&
+//                      mmdns_loadgen --rate=20000 --mix=ptr:60,srv:20,txt:20'
+//
+// Queries ask for unicast responses unless --multicast is given, so that the
+// numbers are those of the responder rather than of the RFC 6762 §6 limit of
+// one multicast of a record per second. A response counts as the answer to
+// every query still waiting for its records, the responder aggregates them
+// the same way. A browse that lists every instance as a known answer has
+// nothing left to answer (RFC 6762 §7.1), it counts as suppressed rather
+// than as waiting for an answer.
+
+#include <algorithm>
+#include <array>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "detail/mdns_log.hpp"
+#include "detail/metrics.hpp"
+#include "detail/name_kernels.hpp"
+#include "mdns_client.hpp"
+#include "mdns_message.hpp"
+#include "mdns_message_decoder.hpp"
+#include "mdns_service_query.hpp"
+#include "net/net_steam.hpp"
+
+using namespace mmdns;
+using namespace std::chrono_literals;
+
+namespace {
+
+using clock_type = std::chrono::steady_clock;
+using udp = boost::asio::ip::udp;
+
+const auto mdns_group = boost::asio::ip::make_address("224.0.0.251");
+constexpr uint16_t mdns_port = 5353;
+constexpr const char* service_type = "_loadgen._tcp";
+
+struct options {
+  double rate = 1000;
+  double duration = 10;
+  size_t services = 10;
+  size_t shards = 1;
+  // Weights of PTR browses, SRV and TXT resolves and ANY queries
+  std::map<std::string, unsigned> mix = {
+      {"ptr", 40}, {"srv", 30}, {"txt", 20}, {"any", 10}};
+  // Share of the instances that browses list as known answers
+  double known_answers = 0;
+  bool multicast = false;
+  std::chrono::milliseconds timeout = 1000ms;
+};
+
+void usage(const char* program) {
+  std::fprintf(
+      stderr,
+      "usage: %s [options]\n"
+      "  --rate=N           queries per second to send (1000)\n"
+      "  --duration=S       seconds to send for (10)\n"
+      "  --services=N       services the responder registers (10)\n"
+      "  --shards=N         receive shards of the responder (1)\n"
+      "  --mix=T:W,...      query types by weight, T one of ptr, srv, txt,\n"
+      "                     any (ptr:40,srv:30,txt:20,any:10)\n"
+      "  --known-answers=F  share of the instances browses list as known\n"
+      "                     answers, 0 to 1 (0)\n"
+      "  --multicast        ask for multicast responses\n"
+      "  --timeout=MS       how long a query waits for an answer (1000)\n",
+      program);
+}
+
+bool parse_mix(const std::string& value,
+               std::map<std::string, unsigned>& mix) {
+  mix.clear();
+  size_t start = 0;
+  while (start <= value.size()) {
+    size_t end = value.find(',', start);
+    if (end == std::string::npos) {
+      end = value.size();
+    }
+
+    const auto entry = value.substr(start, end - start);
+    const auto colon = entry.find(':');
+    if (colon == std::string::npos) {
+      return false;
+    }
+    const auto type = entry.substr(0, colon);
+    if (type != "ptr" && type != "srv" && type != "txt" && type != "any") {
+      return false;
+    }
+    mix[type] = std::strtoul(entry.c_str() + colon + 1, nullptr, 10);
+    start = end + 1;
+  }
+
+  for (const auto& [type, weight] : mix) {
+    if (weight != 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool parse_options(int argc, char** argv, options& parsed) {
+  for (int idx = 1; idx < argc; idx++) {
+    const std::string arg = argv[idx];
+    const auto equals = arg.find('=');
+    const auto name = arg.substr(0, equals);
+    const auto value =
+        equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+    if (name == "--rate") {
+      parsed.rate = std::strtod(value.c_str(), nullptr);
+    } else if (name == "--duration") {
+      parsed.duration = std::strtod(value.c_str(), nullptr);
+    } else if (name == "--services") {
+      parsed.services = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--shards") {
+      parsed.shards = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--mix") {
+      if (!parse_mix(value, parsed.mix)) {
+        return false;
+      }
+    } else if (name == "--known-answers") {
+      parsed.known_answers = std::strtod(value.c_str(), nullptr);
+    } else if (name == "--multicast") {
+      parsed.multicast = true;
+    } else if (name == "--timeout") {
+      parsed.timeout =
+          std::chrono::milliseconds(std::strtoul(value.c_str(), nullptr, 10));
+    } else {
+      return false;
+    }
+  }
+
+  return parsed.rate > 0 && parsed.duration > 0 && parsed.services > 0 &&
+         parsed.known_answers >= 0 && parsed.known_answers <= 1;
+}
+
+std::string instance_name(size_t idx) {
+  return "load" + std::to_string(idx) + "." + service_type + ".local";
+}
+
+std::string folded(std::string name) {
+  detail::fold_case(name.data(), name.size(), name.data());
+  return name;
+}
+
+// A query ready to go, which of the records in a response answer it, and
+// whether the responder should stay silent because it lists them all as
+// known answers
+struct query_kind {
+  std::vector<client::packet> packets;
+  std::string name;
+  message::mdns_rr_type type;
+  bool suppressed;
+};
+
+// Queries waiting for an answer by the name and type they ask for, oldest
+// first, and what became of those that are done
+class tracker {
+ public:
+  explicit tracker(std::chrono::milliseconds timeout)
+      : timeout_(timeout),
+        waiting_(),
+        latency_(),
+        answered_(0),
+        dropped_(0),
+        suppressed_(0) {}
+
+  void sent(const query_kind& query, clock_type::time_point at) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (query.suppressed) {
+      suppressed_++;
+      return;
+    }
+    waiting_[{query.name, query.type}].push_back(at);
+  }
+
+  // Every query waiting for a record of |response| is answered by it
+  void received(const message::mdns_message_t& response,
+                clock_type::time_point at) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& rr : response.answers) {
+      const auto name = folded(rr.name.to_string());
+      answer_(name, static_cast<message::mdns_rr_type>(rr.type), at);
+      answer_(name, message::ANY, at);
+    }
+  }
+
+  // Gives up on the queries that waited longer than the timeout
+  void expire(clock_type::time_point now) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [key, times] : waiting_) {
+      while (!times.empty() && now - times.front() > timeout_) {
+        times.pop_front();
+        dropped_++;
+      }
+    }
+  }
+
+  uint64_t answered() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return answered_;
+  }
+
+  uint64_t dropped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return dropped_;
+  }
+
+  uint64_t suppressed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return suppressed_;
+  }
+
+  detail::histogram latency() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return latency_;
+  }
+
+ private:
+  void answer_(const std::string& name,
+               message::mdns_rr_type type,
+               clock_type::time_point at) {
+    auto itr = waiting_.find({name, type});
+    if (itr == waiting_.end()) {
+      return;
+    }
+
+    for (auto sent : itr->second) {
+      latency_.record(
+          std::chrono::duration_cast<std::chrono::microseconds>(at - sent)
+              .count());
+      answered_++;
+    }
+    itr->second.clear();
+  }
+
+  const std::chrono::milliseconds timeout_;
+  mutable std::mutex mutex_;
+  std::map<std::pair<std::string, message::mdns_rr_type>,
+           std::deque<clock_type::time_point>>
+      waiting_;
+  detail::histogram latency_;
+  uint64_t answered_;
+  uint64_t dropped_;
+  uint64_t suppressed_;
+};
+
+// Reads responses off |socket| until its io_context stops
+class listener {
+ public:
+  listener(udp::socket& socket, tracker& queries)
+      : socket_(socket), queries_(queries), buffer_(), sender_(), count_(0) {}
+
+  void start() {
+    socket_.async_receive_from(
+        boost::asio::buffer(buffer_), sender_,
+        [this](const boost::system::error_code& ec, size_t size) {
+          if (ec == boost::asio::error::operation_aborted) {
+            return;
+          }
+          if (!ec) {
+            on_packet_(size);
+          }
+          start();
+        });
+  }
+
+  uint64_t count() const { return count_; }
+
+ private:
+  void on_packet_(size_t size) {
+    const auto now = clock_type::now();
+    net::net_stream stream(buffer_.data(), size);
+    message::mdns_message_t message;
+    // Queries show up too on the group, ours included
+    if (!codec::mdns_message_decoder{message}.decode(stream) ||
+        message.header.is_query()) {
+      return;
+    }
+
+    count_++;
+    queries_.received(message, now);
+  }
+
+  udp::socket& socket_;
+  tracker& queries_;
+  std::array<net::net_stream_data, 9000> buffer_;
+  udp::endpoint sender_;
+  uint64_t count_;
+};
+
+// The PTR records of the registered services, the way a browser that already
+// found them would have them cached
+std::vector<client::cached_record> known_instances(
+    const std::vector<service::descriptor>& registered) {
+  std::vector<client::cached_record> known;
+  const auto type = folded(std::string(service_type) + ".local");
+  for (const auto& service : registered) {
+    net::net_stream stream(service.response->data(), service.response->size());
+    message::mdns_message_t message;
+    if (!codec::mdns_message_decoder{message}.decode(stream)) {
+      continue;
+    }
+
+    for (const auto& rr : service::record::from_rrs(
+             {&message.answers},
+             [&type](const message::mdns_rr_t& answer) {
+               return answer.type == message::PTR &&
+                      folded(answer.name.to_string()) == type;
+             })) {
+      known.push_back({rr, rr->ttl});
+    }
+  }
+  return known;
+}
+
+std::vector<query_kind> make_queries(
+    const options& opts,
+    const std::vector<client::cached_record>& known) {
+  const bool unicast = !opts.multicast;
+  const auto type_name = folded(std::string(service_type) + ".local");
+  const std::vector<client::cached_record> known_listed(
+      known.begin(), known.begin() + static_cast<size_t>(
+                                         known.size() * opts.known_answers));
+  const bool all_known = !known.empty() && known_listed.size() == known.size();
+
+  std::vector<query_kind> queries;
+  for (const auto& [kind, weight] : opts.mix) {
+    for (unsigned copy = 0; copy < weight; copy++) {
+      if (kind == "ptr") {
+        queries.push_back(
+            {client::encode_query({{type_name, message::PTR, unicast}},
+                                  known_listed),
+             type_name, message::PTR, all_known});
+        continue;
+      }
+
+      const auto name = folded(instance_name(queries.size() % opts.services));
+      const auto type = kind == "srv"   ? message::SRV
+                        : kind == "txt" ? message::TXT
+                                        : message::ANY;
+      queries.push_back(
+          {client::encode_query({{name, type, unicast}}, {}), name, type,
+           false});
+    }
+  }
+
+  // Interleaved rather than in runs of one type
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(5353));
+  return queries;
+}
+
+double milliseconds(uint64_t microseconds) {
+  return microseconds / 1000.0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  options opts;
+  if (!parse_options(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // Every probe and announcement would be logged otherwise
+  detail::set_log_level(detail::log_level::warning);
+
+  client::mdns_client<net::net_stream> responder{opts.shards};
+  responder.async_start();
+
+  std::mutex registered_mutex;
+  std::vector<service::descriptor> registered;
+  for (size_t idx = 0; idx < opts.services; idx++) {
+    responder.register_service(
+        service::descriptor{"load" + std::to_string(idx),
+                            "loadgen.local",
+                            service_type,
+                            "local",
+                            static_cast<uint16_t>(9000 + idx % 1000),
+                            {{"path", "/load"}, {"id", std::to_string(idx)}}},
+        [&](bool ok, const service::descriptor& service) {
+          std::lock_guard<std::mutex> lock(registered_mutex);
+          if (ok) {
+            registered.push_back(service);
+          }
+        });
+  }
+
+  const auto give_up = clock_type::now() + 10s;
+  for (;;) {
+    std::this_thread::sleep_for(50ms);
+    std::lock_guard<std::mutex> lock(registered_mutex);
+    if (registered.size() == opts.services) {
+      break;
+    }
+    if (clock_type::now() > give_up) {
+      std::fprintf(stderr, "Only %zu of %zu services registered\n",
+                   registered.size(), opts.services);
+      return 1;
+    }
+  }
+
+  const auto queries = make_queries(opts, known_instances(registered));
+  tracker waiting(opts.timeout);
+
+  // Unicast responses come back to the port queries go out from, multicast
+  // ones to the group
+  boost::asio::io_context io_ctx;
+  udp::socket out(io_ctx, udp::endpoint(udp::v4(), 0));
+  out.set_option(boost::asio::ip::multicast::enable_loopback(true));
+  listener unicast_listener(out, waiting);
+  unicast_listener.start();
+
+  udp::socket group(io_ctx);
+  listener multicast_listener(group, waiting);
+  if (opts.multicast) {
+    group.open(udp::v4());
+    group.set_option(udp::socket::reuse_address(true));
+    group.set_option(boost::asio::ip::multicast::join_group(mdns_group));
+    group.bind(udp::endpoint(udp::v4(), mdns_port));
+    multicast_listener.start();
+  }
+  std::thread receiver([&io_ctx]() { io_ctx.run(); });
+
+  // Paced against the clock rather than by sleeping a period per packet, so
+  // the rate holds when the sender falls behind for a moment
+  const udp::endpoint destination(mdns_group, mdns_port);
+  const auto period = std::chrono::duration_cast<clock_type::duration>(
+      std::chrono::duration<double>(1 / opts.rate));
+  const auto start = clock_type::now();
+  const auto end =
+      start + std::chrono::duration_cast<clock_type::duration>(
+                  std::chrono::duration<double>(opts.duration));
+  auto next = start;
+  auto next_expiry = start + 100ms;
+  uint64_t sent = 0;
+  uint64_t send_errors = 0;
+  while (next < end) {
+    std::this_thread::sleep_until(next);
+    const auto now = clock_type::now();
+    for (; next <= now && next < end; next += period) {
+      const auto& query = queries[sent % queries.size()];
+      waiting.sent(query, clock_type::now());
+      for (const auto& data : query.packets) {
+        boost::system::error_code ec;
+        out.send_to(boost::asio::buffer(*data), destination, 0, ec);
+        send_errors += ec ? 1 : 0;
+      }
+      sent++;
+    }
+
+    if (now >= next_expiry) {
+      waiting.expire(now);
+      next_expiry = now + 100ms;
+    }
+  }
+  const auto sending = clock_type::now() - start;
+
+  // Whatever is still waiting gets the timeout to be answered
+  std::this_thread::sleep_for(opts.timeout + 10ms);
+  waiting.expire(clock_type::now());
+  io_ctx.stop();
+  receiver.join();
+
+  const double seconds = std::chrono::duration<double>(sending).count();
+  const auto latency = waiting.latency();
+  const auto answered = waiting.answered();
+  const auto dropped = waiting.dropped();
+  const auto suppressed = waiting.suppressed();
+  // Only the queries that should have had an answer
+  const auto expected = sent - suppressed;
+  const auto served = responder.metrics().collect();
+
+  std::printf("target_rate_qps %.0f\n", opts.rate);
+  std::printf("sent_qps %.0f\n", sent / seconds);
+  std::printf("queries_sent %" PRIu64 "\n", sent);
+  std::printf("send_errors %" PRIu64 "\n", send_errors);
+  std::printf("responses_received %" PRIu64 "\n",
+              unicast_listener.count() + multicast_listener.count());
+  std::printf("queries_answered %" PRIu64 "\n", answered);
+  std::printf("answered_qps %.0f\n", answered / seconds);
+  std::printf("queries_suppressed %" PRIu64 "\n", suppressed);
+  std::printf("queries_dropped %" PRIu64 "\n", dropped);
+  std::printf("drop_ratio %.4f\n",
+              expected ? double(dropped) / expected : 0.0);
+  std::printf("latency_p50_ms %.3f\n", milliseconds(latency.percentile(0.5)));
+  std::printf("latency_p99_ms %.3f\n",
+              milliseconds(latency.percentile(0.99)));
+  std::printf("latency_p999_ms %.3f\n",
+              milliseconds(latency.percentile(0.999)));
+  for (auto which : {detail::counter::packets_received,
+                     detail::counter::packets_filtered,
+                     detail::counter::queries_matched,
+                     detail::counter::responses_sent,
+                     detail::counter::responses_suppressed}) {
+    std::printf("responder_%s %" PRIu64 "\n", detail::to_string(which),
+                served[which]);
+  }
+
+  responder.stop();
+  return 0;
+}
@@ -0,0 +1,198 @@
+// Runs a link full of mdns_clients in one process, on a net::sim::bus in
+// virtual time, and reports how long it takes them to find each other. Every
+// host registers a service of the same type and browses for that type, all at
+// once, as if they had been switched on together:
+//
+//   mmdns_sim --hosts=1000
+//
+// Nothing touches the network or the wall clock, so it needs no privileges,
+// and a run with the same options reports the same numbers every time, but
+// for wall_ms. With --names below --hosts, hosts share instance names and
+// have to settle who keeps them.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "detail/clock.hpp"
+#include "detail/mdns_log.hpp"
+#include "detail/metrics.hpp"
+#include "mdns_client.hpp"
+#include "net/net_steam.hpp"
+#include "net/sim_transport.hpp"
+
+using namespace mmdns;
+using namespace std::chrono_literals;
+
+namespace {
+
+using sim_client = client::mdns_client<net::net_stream, net::sim::transport>;
+
+constexpr const char* service_type = "_sim._tcp";
+
+struct options {
+  size_t hosts = 1000;
+  // Distinct instance names, as many as there are hosts unless given
+  size_t names = 0;
+  uint64_t seed = 1;
+  std::chrono::microseconds latency = 100us;
+  std::chrono::microseconds step = 1000us;
+  std::chrono::seconds timeout = 60s;
+};
+
+void usage(const char* program) {
+  std::fprintf(
+      stderr,
+      "usage: %s [options]\n"
+      "  --hosts=N          hosts on the link (1000)\n"
+      "  --names=N          distinct instance names among them (hosts)\n"
+      "  --seed=N           seed of the random delays (1)\n"
+      "  --latency=US       microseconds a datagram takes to arrive (100)\n"
+      "  --step=US          microseconds virtual time moves on by when\n"
+      "                     nothing is left to do (1000)\n"
+      "  --timeout=S        virtual seconds to give up after (60)\n",
+      program);
+}
+
+bool parse_options(int argc, char** argv, options& parsed) {
+  for (int idx = 1; idx < argc; idx++) {
+    const std::string arg = argv[idx];
+    const auto equals = arg.find('=');
+    const auto name = arg.substr(0, equals);
+    const auto value =
+        equals == std::string::npos ? std::string() : arg.substr(equals + 1);
+
+    if (name == "--hosts") {
+      parsed.hosts = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--names") {
+      parsed.names = std::strtoul(value.c_str(), nullptr, 10);
+    } else if (name == "--seed") {
+      parsed.seed = std::strtoull(value.c_str(), nullptr, 10);
+    } else if (name == "--latency") {
+      parsed.latency =
+          std::chrono::microseconds(std::strtoul(value.c_str(), nullptr, 10));
+    } else if (name == "--step") {
+      parsed.step =
+          std::chrono::microseconds(std::strtoul(value.c_str(), nullptr, 10));
+    } else if (name == "--timeout") {
+      parsed.timeout =
+          std::chrono::seconds(std::strtoul(value.c_str(), nullptr, 10));
+    } else {
+      return false;
+    }
+  }
+
+  if (parsed.names == 0) {
+    parsed.names = parsed.hosts;
+  }
+  return parsed.hosts > 0 && parsed.names <= parsed.hosts &&
+         parsed.step.count() > 0 && parsed.timeout.count() > 0;
+}
+
+double milliseconds(detail::clock::duration elapsed) {
+  return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  options opts;
+  if (!parse_options(argc, argv, opts)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // Every probe and announcement of every host would be logged otherwise
+  detail::set_log_level(detail::log_level::warning);
+
+  const auto wall_start = std::chrono::steady_clock::now();
+
+  // Declared first, the clients send their goodbyes through it on the way out
+  net::sim::bus network(opts.seed, opts.latency, opts.step);
+  const auto start = detail::clock::now();
+
+  std::vector<std::unique_ptr<sim_client>> hosts;
+  std::vector<size_t> seen(opts.hosts, 0);
+  std::set<std::string> won;
+  size_t settled = 0;
+
+  for (size_t idx = 0; idx < opts.hosts; idx++) {
+    auto& host = hosts.emplace_back(std::make_unique<sim_client>(
+        1, net::sim::transport::config{&network}));
+    host->open();
+    network.drive([host = host.get()]() { return host->poll(); });
+
+    host->register_service(
+        service::descriptor{"node" + std::to_string(idx % opts.names),
+                            "host" + std::to_string(idx) + ".local",
+                            service_type,
+                            "local",
+                            static_cast<uint16_t>(8000 + idx % 1000),
+                            {{"id", std::to_string(idx)}}},
+        [&won, &settled](bool ok, const service::descriptor& service) {
+          if (ok) {
+            won.insert(service.name);
+          }
+          settled++;
+        });
+    host->browse(
+        std::string(service_type) + ".local",
+        [&seen, idx](const std::string&) { seen[idx]++; },
+        [&seen, idx](const std::string&) { seen[idx]--; });
+  }
+
+  // Converged once every registration is through and every host sees every
+  // name that was won
+  const bool converged =
+      network.run_for(opts.timeout, [&]() {
+        if (settled < opts.hosts) {
+          return false;
+        }
+        for (auto count : seen) {
+          if (count != won.size()) {
+            return false;
+          }
+        }
+        return true;
+      });
+  const auto elapsed = detail::clock::now() - start;
+
+  size_t fewest = won.size();
+  for (auto count : seen) {
+    fewest = std::min(fewest, count);
+  }
+
+  detail::metrics::snapshot total{};
+  for (const auto& host : hosts) {
+    const auto served = host->metrics().collect();
+    for (size_t idx = 0; idx < detail::counter_count; idx++) {
+      total.counters[idx] += served.counters[idx];
+    }
+  }
+
+  std::printf("hosts %zu\n", opts.hosts);
+  std::printf("names %zu\n", opts.names);
+  std::printf("seed %" PRIu64 "\n", opts.seed);
+  std::printf("converged %d\n", converged ? 1 : 0);
+  std::printf("virtual_ms %.3f\n", milliseconds(elapsed));
+  std::printf("registrations_settled %zu\n", settled);
+  std::printf("names_won %zu\n", won.size());
+  std::printf("fewest_instances_seen %zu\n", fewest);
+  std::printf("packets_sent %" PRIu64 "\n", network.packets_sent());
+  std::printf("packets_delivered %" PRIu64 "\n", network.deliveries());
+  for (size_t idx = 0; idx < detail::counter_count; idx++) {
+    const auto which = static_cast<detail::counter>(idx);
+    std::printf("hosts_%s %" PRIu64 "\n", detail::to_string(which),
+                total[which]);
+  }
+
+  hosts.clear();
+  std::printf("wall_ms %.0f\n",
+              milliseconds(std::chrono::steady_clock::now() - wall_start));
+  return converged ? 0 : 1;
+}